@@ -34,6 +34,8 @@ namespace MathDAG
   {return se.derivative(*this);}
   NodePtr ConstantDAG::derivative(SystemOfEquations& se) const
   {return se.derivative(*this);}
+  NodePtr SwitchDAG::derivative(SystemOfEquations& se) const
+  {return se.derivative(*this);}
 
   string differentiateName(const string& x)
   {
@@ -107,6 +109,18 @@ namespace MathDAG
     return zero;
   }
 
+  // the selector is piecewise constant, so the derivative switches
+  // between the derivatives of the cases
+  template <>
+  NodePtr SystemOfEquations::derivative(const SwitchDAG& expr)
+  {
+    auto r=std::make_shared<SwitchDAG>();
+    r->selector=expr.selector;
+    for (auto& c: expr.cases)
+      r->cases.push_back(expressionCache.insertAnonymous(c->derivative(*this)));
+    return expressionCache.insertAnonymous(r);
+  }
+
   template <>
   NodePtr SystemOfEquations::derivative
   (const OperationDAG<OperationType::constant>& expr)
@@ -222,6 +222,19 @@ namespace MathDAG
     print(surf.cairo(), latexToPango(mathrm(name)), Anchor::nw);
   }
 
+  void SwitchDAG::render(ecolab::cairo::Surface& surf) const
+  {
+    print(surf.cairo(),"switch",Anchor::nw);
+    parenthesise(surf, [&](Surface& surf){
+        selector->render(surf);
+        for (auto& c: cases)
+          {
+            print(surf.cairo(),", ",Anchor::nw);
+            c->render(surf);
+          }
+      });
+  }
+
 
   template <>
   void OperationDAG<OperationType::constant>::render(Surface& surf) const 
@@ -23,6 +23,13 @@
 #include "str.h"
 #include "flowCoef.h"
 #include <ecolab_epilogue.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <set>
+
 using namespace minsky;
 
 namespace MathDAG
@@ -262,6 +269,21 @@ namespace MathDAG
   VariableValue OperationDAGBase::addEvalOps
   (EvalOpVector& ev, const VariableValue& r) const
   {
+    auto setOutputPorts=[&]() {
+      if (state && !state->ports.empty() && state->ports[0]) 
+        state->ports[0]->setVariableValue(result);
+      for (auto& a: aliases)
+        if (a && !a->ports.empty() && a->ports[0])
+          a->ports[0]->setVariableValue(result);
+    };
+
+    if (result.idx()<0 && simplified)
+      {
+        result=simplified->addEvalOps(ev, r);
+        setOutputPorts();
+        return result;
+      }
+
     if (result.idx()<0)
       {
         if (IntOp* i=dynamic_cast<IntOp*>(state.get()))
@@ -285,8 +307,7 @@ namespace MathDAG
         else 
           result.allocValue();
 
-        if (state && !state->ports.empty() && state->ports[0]) 
-          state->ports[0]->setVariableValue(result);
+        setOutputPorts();
 
         // prepare argument expressions
         vector<vector<VariableValue> > argIdx(arguments.size());
@@ -352,6 +373,132 @@ namespace MathDAG
     return result;
   }
 
+  namespace
+  {
+    /// collect the nodes reachable from \a x that have not yet been
+    /// evaluated into \a nodes, stopping at variables, which are
+    /// collected into \a vars
+    void unevaluated(const Node& x, set<const Node*>& seen, vector<const Node*>& nodes,
+                     vector<const VariableDAG*>& vars)
+    {
+      if (x.result.idx()>=0 || !seen.insert(&x).second) return;
+      if (auto v=dynamic_cast<const VariableDAG*>(&x))
+        {
+          vars.push_back(v);
+          return;
+        }
+      nodes.push_back(&x);
+      if (auto o=dynamic_cast<const OperationDAGBase*>(&x))
+        {
+          if (o->simplified)
+            unevaluated(*o->simplified, seen, nodes, vars);
+          else if (o->type()!=OperationType::integrate)
+            for (auto& port: o->arguments)
+              for (auto& a: port)
+                if (a) unevaluated(*a, seen, nodes, vars);
+        }
+      else if (auto s=dynamic_cast<const SwitchDAG*>(&x))
+        {
+          unevaluated(*s->selector, seen, nodes, vars);
+          for (auto& c: s->cases)
+            unevaluated(*c, seen, nodes, vars);
+        }
+    }
+  }
+
+  int SwitchDAG::order(unsigned maxOrder) const
+  {
+    if (maxOrder==0)
+      throw error("maximum order recursion reached");
+    int order=selector->order(maxOrder-1);
+    for (auto& c: cases)
+      order=std::max(order, c->order(maxOrder-1));
+    return order;
+  }
+
+  VariableValue SwitchDAG::addEvalOps
+  (EvalOpVector& ev, const VariableValue& r) const
+  {
+    if (result.idx()<0)
+      {
+        if (r.isFlowVar() && r.idx()>=0)
+          result=r;
+        else
+          result.allocValue();
+        if (state && !state->ports.empty() && state->ports[0])
+          state->ports[0]->setVariableValue(result);
+
+        VariableValue x=selector->addEvalOps(ev);
+        // variables may be used elsewhere, so are evaluated
+        // unconditionally
+        {
+          set<const Node*> seen;
+          vector<const Node*> nodes;
+          vector<const VariableDAG*> vars;
+          for (auto& c: cases)
+            unevaluated(*c, seen, nodes, vars);
+          for (auto v: vars)
+            v->addEvalOps(ev);
+        }
+
+        auto select=new SelectEvalOp(result.idx(), x.idx(), x.isFlowVar());
+        ev.emplace_back();
+        ev.back().reset(select);
+        size_t start=ev.size();
+        for (auto& c: cases)
+          {
+            // nodes first evaluated within a case are only computed
+            // when that case is selected, so are forgotten
+            // afterwards, to be evaluated afresh if used elsewhere
+            set<const Node*> seen;
+            vector<const Node*> local;
+            vector<const VariableDAG*> vars;
+            unevaluated(*c, seen, local, vars);
+            ev.push_back(EvalOpPtr(OperationType::copy, result, c->addEvalOps(ev)));
+            for (auto n: local)
+              n->result=VariableValue(VariableType::flow);
+            select->caseEnd.push_back(ev.size()-start);
+          }
+      }
+    if (r.isFlowVar() && r.idx()>=0 && result.idx()!=r.idx())
+      ev.push_back(EvalOpPtr(OperationType::copy, r, result));
+    return result;
+  }
+
+  ostream& SwitchDAG::latex(ostream& o) const
+  {
+    o<<"\\begin{cases}";
+    for (size_t i=0; i<cases.size(); ++i)
+      {
+        o<<cases[i]->latex()<<"&";
+        if (i==0)
+          o<<selector->latex()<<"<1";
+        else if (i==cases.size()-1)
+          o<<selector->latex()<<"\\geq "<<i;
+        else
+          o<<i<<"\\leq "<<selector->latex()<<"<"<<i+1;
+        o<<"\\\\";
+      }
+    return o<<"\\end{cases}";
+  }
+
+  ostream& SwitchDAG::matlab(ostream& o) const
+  {
+    o<<"(";
+    for (size_t i=0; i<cases.size(); ++i)
+      {
+        if (i>0) o<<"+";
+        o<<"("<<cases[i]->matlab()<<")*";
+        if (i==0)
+          o<<"("<<selector->matlab()<<"<1)";
+        else if (i==cases.size()-1)
+          o<<"("<<selector->matlab()<<">="<<i<<")";
+        else
+          o<<"("<<selector->matlab()<<">="<<i<<"&"<<selector->matlab()<<"<"<<i+1<<")";
+      }
+    return o<<")";
+  }
+
   template <>
   ostream& OperationDAG<OperationType::constant>::matlab(ostream& o) const
   {
@@ -1278,10 +1425,293 @@ namespace MathDAG
             for (auto w: p->wires)
               r->arguments[i-1].push_back(getNodeFromWire(*w));
           }
+
+        // collapse onto a structurally identical operation, if any
+        string sk=structuralKey(*r);
+        if (!sk.empty())
+          {
+            NodePtr n=expressionCache.hashCons(op, sk, r);
+            if (n!=r)
+              {
+                dynamic_cast<OperationDAGBase&>(*n).aliases.push_back(r->state);
+                return n;
+              }
+          }
         return r;
       }
   }
 
+  string SystemOfEquations::structuralKey(const OperationDAGBase& op) const
+  {
+    switch (op.type())
+      {
+        // stateful, or identified by their icon
+      case OperationType::constant:
+      case OperationType::integrate:
+      case OperationType::differentiate:
+      case OperationType::data:
+        return "";
+      default:
+        break;
+      }
+
+    // arguments have already been merged, so are identified by
+    // address, except constants, which are identified by value
+    auto argKey=[](const WeakNodePtr& x)->string {
+      char buf[32];
+      if (!x)
+        return string("-");
+      else if (auto c=dynamic_cast<const OperationDAG<OperationType::constant>*>(x.payload))
+        snprintf(buf,sizeof(buf),"=%a",c->init);
+      else if (auto c=dynamic_cast<const ConstantDAG*>(x.payload))
+        snprintf(buf,sizeof(buf),"=%a",c->value);
+      else
+        snprintf(buf,sizeof(buf),"%p",static_cast<const void*>(x.payload));
+      return string(buf);
+    };
+
+    vector<vector<string>> args;
+    for (auto& port: op.arguments)
+      {
+        args.emplace_back();
+        for (auto& a: port)
+          args.back().push_back(argKey(a));
+      }
+
+    switch (op.type())
+      {
+      case OperationType::add:
+      case OperationType::multiply:
+        // fully commutative: pool both ports
+        for (size_t i=1; i<args.size(); ++i)
+          args[0].insert(args[0].end(), args[i].begin(), args[i].end());
+        args.resize(1);
+        sort(args[0].begin(), args[0].end());
+        break;
+      case OperationType::subtract:
+      case OperationType::divide:
+        // commutative within each port
+        for (auto& a: args)
+          sort(a.begin(), a.end());
+        break;
+      default:
+        break;
+      }
+
+    string r=OperationType::typeName(op.type());
+    for (auto& port: args)
+      {
+        r+='(';
+        for (auto& a: port)
+          r+=a+',';
+        r+=')';
+      }
+    return r;
+  }
+
+  namespace
+  {
+    /// follow the simplifications of \a x
+    const Node* resolve(const Node* x)
+    {
+      while (auto o=dynamic_cast<const OperationDAGBase*>(x))
+        if (o->simplified)
+          x=o->simplified.payload;
+        else
+          break;
+      return x;
+    }
+
+    /// true if \a x has no icon displaying its value
+    bool anonymousOp(const OperationDAGBase& x)
+    {return !x.state && x.aliases.empty();}
+  }
+
+  void SystemOfEquations::simplify(bool foldParams)
+  {
+    foldParameters=foldParams;
+    simplifiedNodes.clear();
+    // variables are in order of definition, so constant variables
+    // are known before they are used
+    for (auto v: variables)
+      if (v->rhs)
+        v->rhs=simplifyNode(*v->rhs);
+  }
+
+  bool SystemOfEquations::constantValue(const Node& x, double& value) const
+  {
+    auto n=resolve(&x);
+    if (auto c=dynamic_cast<const ConstantDAG*>(n))
+      {
+        value=c->value;
+        return true;
+      }
+    if (auto c=dynamic_cast<const OperationDAG<OperationType::constant>*>(n))
+      {
+        value=c->init;
+        return true;
+      }
+    if (auto v=dynamic_cast<const VariableDAG*>(n))
+      {
+        // integral inputs are not the value of the variable. Constant
+        // variables, like parameters, can be altered by their sliders
+        // during a simulation
+        if (dynamic_cast<const IntegralInputVariableDAG*>(v) ||
+            ((v->type==VariableType::parameter || v->type==VariableType::constant)
+             && !foldParameters))
+          return false;
+        if (v->rhs)
+          return constantValue(*v->rhs, value);
+        if (v->type==VariableType::constant || v->type==VariableType::parameter)
+          {
+            value=v->init;
+            return true;
+          }
+      }
+    return false;
+  }
+
+  Node* SystemOfEquations::simplifyNode(Node& x)
+  {
+    auto memo=simplifiedNodes.find(&x);
+    if (memo!=simplifiedNodes.end()) return memo->second;
+
+    Node* r=&x;
+    // integral inputs are evaluated separately, and other node types
+    // have no arguments
+    auto op=dynamic_cast<OperationDAGBase*>(&x);
+    if (op && op->type()!=OperationType::integrate)
+      {
+        for (auto& port: op->arguments)
+          for (auto& a: port)
+            if (a)
+              a=simplifyNode(*a);
+        if (Node* s=simplifyOp(*op))
+          {
+            if (anonymousOp(*op))
+              r=s;
+            else
+              {
+                // retain operation, so that its icon displays a value
+                op->simplified=s;
+                bypassedOps.push_back(op);
+              }
+          }
+      }
+    else if (auto sw=dynamic_cast<SwitchDAG*>(&x))
+      {
+        sw->selector=simplifyNode(*sw->selector);
+        for (auto& c: sw->cases)
+          c=simplifyNode(*c);
+        // a constant selector always selects the same case
+        double v;
+        if (constantValue(*sw->selector, v))
+          r=sw->cases[SelectEvalOp::selectCase(v, sw->cases.size())].payload;
+      }
+    simplifiedNodes[&x]=r;
+    return r;
+  }
+
+  Node* SystemOfEquations::simplifyOp(const OperationDAGBase& op)
+  {
+    switch (op.type())
+      {
+      case OperationType::add:
+      case OperationType::subtract:
+        return simplifyCumulative(op, false);
+      case OperationType::multiply:
+      case OperationType::divide:
+        return simplifyCumulative(op, true);
+      case OperationType::constant:
+        // evaluated once, rather than on every step
+        return anonymous(NodePtr(new ConstantDAG(op.init)));
+      case OperationType::time:
+      case OperationType::integrate:
+      case OperationType::differentiate:
+      case OperationType::data:
+        return nullptr;
+      default:
+        break;
+      }
+
+    // fold operations on constant arguments
+    if (op.arguments.empty() || op.arguments.size()>2)
+      return nullptr;
+    double x[2]={0,0};
+    for (size_t i=0; i<op.arguments.size(); ++i)
+      if (op.arguments[i].size()!=1 || !op.arguments[i][0] ||
+          !constantValue(*op.arguments[i][0], x[i]))
+        return nullptr;
+    double value=EvalOpPtr(op.type())->evaluate(x[0],x[1]);
+    // leave invalid values to be reported at runtime
+    if (!std::isfinite(value)) return nullptr;
+    return anonymous(NodePtr(new ConstantDAG(value)));
+  }
+
+  Node* SystemOfEquations::simplifyCumulative(const OperationDAGBase& op, bool product)
+  {
+    OperationType::Type inverse=product? OperationType::divide: OperationType::subtract;
+    double identity=product? 1: 0;
+    double c=identity;
+    unsigned numConstants=0;
+    bool changed=false, wired=true;
+    vector<WeakNodePtr> terms[2]; // terms[1] are subtracted, or divided by
+
+    function<void(const OperationDAGBase&,bool)> gather=
+      [&](const OperationDAGBase& o, bool invert) {
+      for (size_t p=0; p<o.arguments.size(); ++p)
+        for (auto& a: o.arguments[p])
+          {
+            if (!a)
+              {
+                wired=false;
+                continue;
+              }
+            bool inv=invert ^ (o.type()==inverse && p==1);
+            double v;
+            auto arg=dynamic_cast<const OperationDAGBase*>(resolve(a.payload));
+            if (constantValue(*a, v))
+              {
+                if (product)
+                  c=inv? c/v: c*v;
+                else
+                  c=inv? c-v: c+v;
+                numConstants++;
+              }
+            else if (arg && anonymousOp(*arg) &&
+                     (arg->type()==(product? OperationType::multiply: OperationType::add) ||
+                      arg->type()==inverse))
+              {
+                // nested sum or product
+                gather(*arg, inv);
+                changed=true;
+              }
+            else
+              terms[inv].push_back(a);
+          }
+    };
+    gather(op, false);
+
+    // leave invalid expressions to be reported at runtime
+    if (!wired || !std::isfinite(c)) return nullptr;
+    if (terms[0].empty() && terms[1].empty())
+      return anonymous(NodePtr(new ConstantDAG(c)));
+    if (c==identity && terms[1].empty() && terms[0].size()==1)
+      return terms[0][0].payload;
+    if (!changed && numConstants<=1 && (numConstants==0 || c!=identity))
+      return nullptr;
+
+    shared_ptr<OperationDAGBase> r
+      (OperationDAGBase::create(terms[1].empty()? (product? OperationType::multiply: OperationType::add): inverse));
+    anonymous(r);
+    r->arguments.resize(2);
+    r->arguments[0]=terms[0];
+    if (c!=identity)
+      r->arguments[0].push_back(anonymous(NodePtr(new ConstantDAG(c))));
+    r->arguments[1]=terms[1];
+    return r.get();
+  }
+
   NodePtr SystemOfEquations::makeDAG(const SwitchIcon& sw)
   {
     // grab list of input wires
@@ -1300,19 +1730,24 @@ namespace MathDAG
       }
 
     assert(wires.size()==sw.numCases()+1);
-    Expr input(expressionCache, getNodeFromWire(*wires[0]));
-
-    auto r=make_shared<OperationDAG<OperationType::add>>();
+    auto r=make_shared<SwitchDAG>();
     expressionCache.insert(sw, r);
-    r->arguments[0].resize(sw.numCases());
-
-    // implemented as a sum of step functions
-    r->arguments[0][0]=getNodeFromWire(*wires[1])*(input<1);        
-    for (unsigned i=1; i<sw.numCases()-1; ++i)
-      r->arguments[0][i]=getNodeFromWire
-        (*wires[i+1])*((input<i+1) - (input<i));
-    r->arguments[0][sw.numCases()-1]=getNodeFromWire
-      (*wires[sw.numCases()])*(1-(input<sw.numCases()-1));
+    r->state=&sw;
+    // only the selected case is evaluated, so an unselected case
+    // cannot render the result invalid
+    for (unsigned i=0; i<wires.size(); ++i)
+      {
+        auto n=getNodeFromWire(*wires[i]);
+        if (!n)
+          {
+            minsky.displayErrorItem(sw);
+            throw error("switch input undefined");
+          }
+        if (i==0)
+          r->selector=n;
+        else
+          r->cases.push_back(n);
+      }
     return r;
   };
 
@@ -1476,6 +1911,10 @@ namespace MathDAG
       }
     assert(minsky.variableValues.validEntries());
 
+    // operations simplified away still display their values
+    for (auto o: bypassedOps)
+      o->addEvalOps(equations);
+
     // ensure all variables have their output port's variable value up to date
     minsky.model->recursiveDo
       (&Group::items,
@@ -196,6 +196,13 @@ namespace MathDAG
     string name;
     double init;
     OperationPtr state;
+    /// other operations found structurally identical to this one, and
+    /// merged into it. Their output ports also receive the result.
+    vector<OperationPtr> aliases;
+    /// expression this operation reduces to, if any, set by
+    /// SystemOfEquations::simplify. It is evaluated in place of
+    /// this operation.
+    WeakNodePtr simplified;
     OperationDAGBase(const string& name=""): 
       name(name) {}
     virtual Type type() const=0;
@@ -246,11 +253,32 @@ namespace MathDAG
     int order(unsigned maxOrder) const override {return 0;} // Godley columns define integration vars
   };
 
+  /// an n-way switch, evaluating only the case selected by \a selector
+  struct SwitchDAG: public Node
+  {
+    WeakNodePtr selector;
+    vector<WeakNodePtr> cases;
+    /// icon whose output port displays the result, if any
+    const SwitchIcon* state=nullptr;
+    int BODMASlevel() const override {return 0;}
+    int order(unsigned maxOrder) const override;
+    ostream& latex(ostream&) const override;
+    ostream& matlab(ostream&) const override;
+    void render(ecolab::cairo::Surface& surf) const override;
+    VariableValue addEvalOps(EvalOpVector&, const VariableValue&) const override;
+    NodePtr derivative(SystemOfEquations&) const override;
+    using Node::latex;
+    using Node::matlab;
+  };
+
   class SubexpressionCache
   {
     std::map<std::string, NodePtr > cache;
     std::map<std::string, VariableDAGPtr> integrationInputs;
     std::map<const Node*, NodePtr> reverseLookupCache;
+    /// operation nodes, keyed by their structure
+    std::map<std::string, NodePtr> structuralCache;
+    size_t merged=0;
   public:
     std::string key(const OperationBase& x) const {
       return "op:"+str(x.ports[0]);
@@ -280,6 +308,18 @@ namespace MathDAG
       reverseLookupCache[n.get()]=n;
       return cache.insert(make_pair(key(x),n)).first->second;
     }
+    /// returns the node previously registered with structural key \a
+    /// sk, rebinding \a x to it, or registers \a n if none
+    template <class T>
+    NodePtr hashCons(const T& x, const std::string& sk, const NodePtr& n) {
+      auto r=structuralCache.insert(make_pair(sk,n));
+      if (r.second) return n;
+      cache[key(x)]=r.first->second;
+      merged++;
+      return r.first->second;
+    }
+    /// number of nodes merged into a structurally identical node
+    size_t numMerged() const {return merged;}
     void insertIntegralInput(const string& name, const VariableDAGPtr& n) {
       integrationInputs.insert(make_pair("input:"+name,n));
       reverseLookupCache[n.get()]=n;
@@ -312,11 +352,33 @@ namespace MathDAG
   class SystemOfEquations
   {
     SubexpressionCache expressionCache;
+    /// key identifying \a op by its type and arguments, or empty if
+    /// \a op must not be merged with other operations
+    string structuralKey(const OperationDAGBase& op) const;
     // these are weak references
     vector<VariableDAG*> variables;
     vector<VariableDAG*> integrationVariables;
     set<string> processedColumns; // to avoid double counting shared columns
 
+    /// @{ state of simplify()
+    bool foldParameters=false;
+    map<const Node*, Node*> simplifiedNodes;
+    /// operations with icons that have been simplified to other
+    /// nodes, and need evaluating only to display their value
+    vector<const OperationDAGBase*> bypassedOps;
+    /// @}
+    /// simplified form of \a x, which replaces it in its parents
+    Node* simplifyNode(Node& x);
+    /// simplified form of \a op, whose arguments have already been
+    /// simplified, or nullptr if no simplification applies
+    Node* simplifyOp(const OperationDAGBase& op);
+    /// simplified sum (\a product=false) or product
+    Node* simplifyCumulative(const OperationDAGBase& op, bool product);
+    /// if \a x evaluates to a constant, return it in \a value
+    bool constantValue(const Node& x, double& value) const;
+    /// manage the lifetime of a new node
+    Node* anonymous(const NodePtr& x) {return expressionCache.insertAnonymous(x).get();}
+
     const Minsky& minsky;
 
     /// create a variable DAG. returns cached value if previously called
@@ -351,6 +413,17 @@ namespace MathDAG
     void populateEvalOpVector
     (EvalOpVector& equations, std::vector<Integral>& integrals);
 
+    /// fold constant subexpressions, remove additions of zero and
+    /// multiplications by one, and collapse nested sums and
+    /// products. If \a foldParameters, parameters and constant
+    /// variables are treated as constants, otherwise they remain
+    /// variables that can be altered during the simulation.
+    void simplify(bool foldParameters=false);
+
+    /// number of operations merged into a structurally identical
+    /// subexpression
+    size_t numMergedSubexpressions() const {return expressionCache.numMerged();}
+
     /// symbolically differentiate \a expr
     template <class Expr> NodePtr derivative(const Expr& expr);
 
@@ -366,6 +439,7 @@ namespace MathDAG
 
   template <> NodePtr SystemOfEquations::derivative(const ConstantDAG&);
   template <> NodePtr SystemOfEquations::derivative(const VariableDAG&);
+  template <> NodePtr SystemOfEquations::derivative(const SwitchDAG&);
 
   template <OperationType::Type T>
   NodePtr OperationDAG<T>::derivative(SystemOfEquations& se) const
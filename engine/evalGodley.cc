@@ -20,6 +20,9 @@
 #include "evalGodley.h"
 #include <ecolab_epilogue.h>
 
+#include <algorithm>
+#include <numeric>
+
 using namespace std;
 
 namespace minsky
@@ -83,15 +86,72 @@ namespace minsky
       }
   }
 
+  void EvalGodley::compress()
+  {
+    vector<size_t> order(sidx.size());
+    iota(order.begin(), order.end(), 0);
+    // stable, so that each row is summed in table order
+    stable_sort(order.begin(), order.end(),
+                [&](size_t a, size_t b) {return sidx[a]<sidx[b];});
+    vector<int> s, f;
+    vector<double> c;
+    for (size_t i: order)
+      {
+        s.push_back(sidx[i]);
+        f.push_back(fidx[i]);
+        c.push_back(m[i]);
+      }
+
+    sidx.resize(0); fidx.resize(0); m.resize(0);
+    rows.resize(0); rowPtr.resize(0);
+    for (size_t k=0; k<s.size(); ++k)
+      {
+        if (k==0 || s[k]!=s[k-1])
+          {
+            rows<<=s[k];
+            rowPtr<<=int(k);
+          }
+        sidx<<=s[k];
+        fidx<<=f[k];
+        m<<=c[k];
+      }
+    rowPtr<<=int(s.size());
+  }
+
   void EvalGodley::eval(double sv[], const double fv[]) const
   {
-    for (size_t i=0; i<initIdx.size(); ++i)
-      sv[initIdx[i]]=0;
+    // each stock variable is a dot product over a contiguous row
+    for (size_t r=0; r<rows.size(); ++r)
+      {
+        double s=0;
+        for (int k=rowPtr[r]; k<rowPtr[r+1]; ++k)
+          s += fv[fidx[k]] * m[k];
+        sv[rows[r]]=s;
+      }
+  }
 
-    for (size_t i=0; i<sidx.size(); ++i)
-      sv[sidx[i]] += fv[fidx[i]] * m[i];
+  template <size_t N>
+  void EvalGodley::evalLanes(double sv[], const double fv[]) const
+  {
+    for (size_t r=0; r<rows.size(); ++r)
+      {
+        double s[N]={};
+        for (int k=rowPtr[r]; k<rowPtr[r+1]; ++k)
+          {
+            const double* f=fv+N*fidx[k];
+            double c=m[k];
+            for (size_t l=0; l<N; ++l)
+              s[l] += f[l] * c;
+          }
+        double* o=sv+N*rows[r];
+        for (size_t l=0; l<N; ++l)
+          o[l]=s[l];
+      }
   }
 
+  template void EvalGodley::evalLanes<4>(double[], const double[]) const;
+  template void EvalGodley::evalLanes<8>(double[], const double[]) const;
+
 //  template <>
 //  const std::vector<std::vector<std::string> >& 
 //  GodleyIteratorAdaptor<GodleyIcons::iterator>::data() const
@@ -34,12 +34,18 @@ namespace minsky
 
   class EvalGodley
   {
-    /// representation of matrix connecting flow variables to stock variables
+    /// representation of matrix connecting flow variables to stock
+    /// variables, in coordinate form, sorted by stock variable
     ecolab::array<int> sidx, fidx;
     ecolab::array<double> m;
 
-    /// index of stock variables that need to be zeroed at start of eval
-    ecolab::array<int> initIdx;
+    /// compressed sparse row form, sharing fidx and m: stock variable
+    /// of each nonempty row, and start of each row's entries
+    /// (terminated by the number of entries)
+    ecolab::array<int> rows, rowPtr;
+
+    /// sort the entries by stock variable, and build the row form
+    void compress();
 
     CLASSDESC_ACCESS(EvalGodley);
   public:
@@ -56,6 +62,27 @@ namespace minsky
     /// flowVars.
     void eval(double sv[], const double fv[]) const;
 
+    /// as eval, but on \a N sets of variables laid out
+    /// [variable][lane] (see EvalTape::evalLanes). Instantiated for
+    /// N=4 and 8.
+    template <size_t N>
+    void evalLanes(double sv[], const double fv[]) const;
+
+    /// @{ Godley matrix in coordinate form: row (stock index), column
+    /// (flow index) and coefficient of each nonzero entry, ordered by
+    /// row
+    const ecolab::array<int>& stockIdx() const {return sidx;}
+    const ecolab::array<int>& flowIdx() const {return fidx;}
+    const ecolab::array<double>& coefs() const {return m;}
+    /// @}
+    /// @{ the same matrix in compressed sparse row form. Row \c r
+    /// defines stock variable rowStock()[r] from the entries
+    /// [rowStart()[r], rowStart()[r+1]) of flowIdx() and coefs().
+    const ecolab::array<int>& rowStock() const {return rows;}
+    const ecolab::array<int>& rowStart() const {return rowPtr;}
+    size_t numRows() const {return rows.size();}
+    /// @}
+
     EvalGodley():  compatibility(false) {}
     /// if compatibility is true, then consttrainst between Godley
     /// tables is not applied, and shared columns are merely summed
@@ -124,8 +151,6 @@ namespace minsky
     fidx.resize(0);
     m.resize(0);
 
-    std::set<int> iidx;
-
     for (GodleyIterator g=begin; g!=end; ++g)
       {
         if (g.data().empty()) continue;
@@ -154,7 +179,6 @@ namespace minsky
                             scCheck.updateColDefs(svName, fvc))
                           continue;
                 
-                        iidx.insert(sv.idx());
                         sidx<<=sv.idx();
                         fidx<<=fv.idx();
                         m<<=fvc.coef;
@@ -163,8 +187,7 @@ namespace minsky
               }
       }
     
-    for (std::set<int>::iterator i=iidx.begin(); i!=iidx.end(); ++i)
-      initIdx<<=*i;
+    compress();
 
     if (!compatibility)
       scCheck.checkSharedColDefs();
@@ -42,15 +42,15 @@ namespace minsky
   void EvalOpBase::reset()
   {
     if (Constant* c=dynamic_cast<Constant*>(state.get()))
-      ValueVector::flowVars[out]=c->value;
+      minsky().flowVars[out]=c->value;
   }
 
-  void EvalOpBase::eval(double fv[], const double sv[])
+  void EvalOpBase::eval(double fv[], const double sv[], double t)
   {
     switch (numArgs())
       {
       case 0:
-        fv[out]=evaluate(0,0);
+        fv[out]=evaluate(t,0);
         break;
       case 1:
         fv[out]=evaluate(flow1? fv[in1]: sv[in1], 0);
@@ -76,7 +76,7 @@ namespace minsky
   void EvalOpBase::deriv(double df[], const double ds[],
                      const double sv[], const double fv[])
   {
-    assert(out>=0 && size_t(out)<ValueVector::flowVars.size());
+    assert(out>=0 && size_t(out)<minsky().flowVars.size());
     switch (numArgs())
       {
       case 0:
@@ -84,8 +84,8 @@ namespace minsky
         return;
       case 1:
         {
-          assert((flow1 && size_t(in1)<ValueVector::flowVars.size()) || 
-                 (!flow1 && size_t(in1)<ValueVector::stockVars.size()));
+          assert((flow1 && size_t(in1)<minsky().flowVars.size()) || 
+                 (!flow1 && size_t(in1)<minsky().stockVars.size()));
           double x1=flow1? fv[in1]: sv[in1];
           double dx1=flow1? df[in1]: ds[in1];
           df[out] = dx1!=0? dx1 * d1(x1,0): 0;
@@ -93,10 +93,10 @@ namespace minsky
         }
       case 2:
         {
-          assert((flow1 && size_t(in1)<ValueVector::flowVars.size()) || 
-                 (!flow1 && size_t(in1)<ValueVector::stockVars.size()));
-          assert((flow2 && size_t(in2)<ValueVector::flowVars.size()) || 
-                 (!flow2 && size_t(in2)<ValueVector::stockVars.size()));
+          assert((flow1 && size_t(in1)<minsky().flowVars.size()) || 
+                 (!flow1 && size_t(in1)<minsky().stockVars.size()));
+          assert((flow2 && size_t(in2)<minsky().flowVars.size()) || 
+                 (!flow2 && size_t(in2)<minsky().stockVars.size()));
           double x1=flow1? fv[in1]: sv[in1];
           double x2=flow2? fv[in2]: sv[in2];
           double dx1=flow1? df[in1]: ds[in1];
@@ -123,11 +123,10 @@ namespace minsky
   double EvalOp<OperationType::constant>::d2(double x1, double x2) const
   {return 0;}
 
-  double EvalOpBase::t;
-
+  // time is supplied as the first argument by eval()
   template <>
   double EvalOp<OperationType::time>::evaluate(double in1, double in2) const
-  {return t;}
+  {return in1;}
   template <> 
   double EvalOp<OperationType::time>::d1(double x1, double x2) const
   {return 0;}
@@ -51,9 +51,6 @@ namespace minsky
   {
     typedef OperationType::Type Type;
 
-    // value used for the time operator
-    static double t;
-
     /// indexes into the Godley variables vector
     int out, in1, in2;
     ///indicate whether in1/in2 are flow variables (out is always a flow variable)
@@ -77,11 +74,11 @@ namespace minsky
     /// number of arguments to this operation
     virtual int numArgs() const =0;
     /// evaluate expression on sv and current value of fv, storing result
-    /// in output variable (of \a fv)
-    void eval(double fv[]=&ValueVector::flowVars[0], 
-              const double sv[]=&ValueVector::stockVars[0]);
+    /// in output variable (of \a fv). \a t is the simulation time
+    void eval(double fv[], const double sv[], double t=0);
  
-    /// evaluate expression on given arguments, returning result
+    /// evaluate expression on given arguments, returning result. For
+    /// operations taking no arguments, \a in1 is the simulation time
     virtual double evaluate(double in1=0, double in2=0) const=0;
     /**
        total derivate with respect to a variable, which is a function of the stock variables.
@@ -138,6 +135,37 @@ namespace minsky
     double evaluate(double in1=0, double in2=0) const override;
    };
 
+  /**
+     Selects between the cases of a switch, evaluating only the
+     selected case. The operations computing each case follow this one
+     in consecutive blocks, each ending with a copy of the case's value
+     to \c out, so this operation can only be evaluated by an
+     EvalTape, which skips the blocks of unselected cases, or by code
+     compiled from one.
+  */
+  struct SelectEvalOp: public EvalOp<minsky::OperationType::numOps>
+  {
+    /// end of each case's block, counted from the operation following
+    /// this one
+    std::vector<size_t> caseEnd;
+    SelectEvalOp(int out=0, int in1=0, bool flow1=true): 
+      EvalOp<OperationType::numOps>(out,in1,out,flow1,true) {}
+    int numArgs() const override {return 1;}
+    unsigned numCases() const {return caseEnd.size();}
+    /// case selected by \a x: below 1 selects case 0, and at or above
+    /// numCases()-1 (or NaN) the last case, as for SwitchIcon
+    static unsigned selectCase(double x, unsigned numCases) {
+      return x<1? 0: x<numCases-1? unsigned(x): numCases-1;
+    }
+    unsigned selectCase(double x) const {return selectCase(x, numCases());}
+    /// @{ the selector is piecewise constant, so does not contribute
+    /// to derivatives
+    double evaluate(double in1=0, double in2=0) const override {return selectCase(in1);}
+    double d1(double x1=0, double x2=0) const override {return 0;}
+    double d2(double x1=0, double x2=0) const override {return 0;}
+    /// @}
+  };
+
   struct EvalOpPtr: public classdesc::shared_ptr<EvalOpBase>, 
                     public OperationType
   {
@@ -0,0 +1,688 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "evalTape.h"
+#include "minsky.h"
+#include "str.h"
+#include "threadPool.h"
+#include <ecolab_epilogue.h>
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <math.h>
+#include <set>
+
+namespace minsky
+{
+  void EvalTape::clear()
+  {
+    opcode.clear();
+    out.clear(); in1.clear(); in2.clear();
+    flags.clear();
+    value.clear();
+    ops.clear();
+    pool.reset();
+    levelStart.clear();
+    inCase.clear();
+  }
+
+  void EvalTape::compile(const EvalOpVector& ev)
+  {
+    clear();
+    opcode.reserve(ev.size());
+    out.reserve(ev.size()); in1.reserve(ev.size()); in2.reserve(ev.size());
+    flags.reserve(ev.size());
+    value.reserve(ev.size());
+    for (auto& e: ev)
+      {
+        opcode.push_back(e->type());
+        out.push_back(e->out);
+        // unused operands are pointed at the output slot, so that
+        // the interpreter can fetch both operands unconditionally
+        bool use1=e->numArgs()>0, use2=e->numArgs()>1;
+        in1.push_back(use1? e->in1: e->out);
+        in2.push_back(use2? e->in2: e->out);
+        flags.push_back((!use1 || e->flow1? flow1: 0) | (!use2 || e->flow2? flow2: 0));
+        if (e->type()==OperationType::constant)
+          value.push_back(e->evaluate());
+        else
+          value.push_back(0);
+        ops.push_back(e);
+      }
+  }
+
+  vector<bool> EvalTape::withinCases() const
+  {
+    vector<bool> r(size());
+    for (size_t i=0; i<size(); ++i)
+      if (opcode[i]==OperationType::numOps)
+        fill(r.begin()+i+1, r.begin()+spanEnd(i), true);
+    return r;
+  }
+
+  vector<size_t> EvalTape::discontinuities() const
+  {
+    vector<size_t> r;
+    for (size_t i=0; i<size(); i=spanEnd(i))
+      switch (opcode[i])
+        {
+        case OperationType::lt: case OperationType::le: case OperationType::eq:
+        case OperationType::and_: case OperationType::or_: case OperationType::not_:
+        case OperationType::floor: case OperationType::frac:
+        case OperationType::numOps:
+          r.push_back(i);
+          break;
+        default:
+          break;
+        }
+    return r;
+  }
+
+  double EvalTape::regime(size_t i, const double fv[], const double sv[]) const
+  {
+    double x1=(flags[i]&flow1)? fv[in1[i]]: sv[in1[i]];
+    double x2=(flags[i]&flow2)? fv[in2[i]]: sv[in2[i]];
+    switch (opcode[i])
+      {
+      case OperationType::lt: case OperationType::le: case OperationType::eq:
+        return (x1>x2)-(x1<x2);
+      case OperationType::and_: case OperationType::or_:
+        return (x1>0.5)+2*(x2>0.5);
+      case OperationType::not_:
+        return x1>0.5;
+      case OperationType::floor: case OperationType::frac:
+        return ::floor(x1);
+      case OperationType::numOps:
+        return selectOp(i).selectCase(x1);
+      default:
+        return 0;
+      }
+  }
+
+  vector<size_t> EvalTape::liveInstructions(const vector<int>& roots) const
+  {
+    vector<bool> live;
+    for (int r: roots)
+      if (r>=0)
+        {
+          if (size_t(r)>=live.size()) live.resize(r+1);
+          live[r]=true;
+        }
+    for (int o: out)
+      if (size_t(o)>=live.size()) live.resize(o+1);
+
+    // a switch and the blocks of its cases are live or dead together
+    vector<size_t> spans;
+    for (size_t i=0; i<size(); i=spanEnd(i))
+      spans.push_back(i);
+
+    vector<size_t> r;
+    for (size_t s=spans.size(); s-->0;)
+      if (live[out[spans[s]]])
+        for (size_t i=spanEnd(spans[s]); i-->spans[s];)
+          {
+            r.push_back(i);
+            int nArgs=ops[i]->numArgs();
+            if (nArgs>0 && (flags[i]&flow1)) live[in1[i]]=true;
+            if (nArgs>1 && (flags[i]&flow2)) live[in2[i]]=true;
+          }
+    reverse(r.begin(), r.end());
+    return r;
+  }
+
+  void EvalTape::select(const EvalTape& tape, const vector<size_t>& instrs)
+  {
+    clear();
+    for (size_t i: instrs)
+      {
+        opcode.push_back(tape.opcode[i]);
+        out.push_back(tape.out[i]);
+        in1.push_back(tape.in1[i]);
+        in2.push_back(tape.in2[i]);
+        flags.push_back(tape.flags[i]);
+        value.push_back(tape.value[i]);
+        ops.push_back(tape.ops[i]);
+      }
+  }
+
+  void EvalTape::allocateSlots(const vector<int>& roots, const vector<int>& slots)
+  {
+    const int n=size();
+    int numSlots=0;
+    for (int i=0; i<n; ++i)
+      {
+        numSlots=max(numSlots, out[i]+1);
+        if (flags[i]&flow1) numSlots=max(numSlots, in1[i]+1);
+        if (flags[i]&flow2) numSlots=max(numSlots, in2[i]+1);
+      }
+    vector<bool> isRoot(numSlots);
+    for (int r: roots)
+      if (r>=0 && r<numSlots) isRoot[r]=true;
+    vector<int> lastWrite(numSlots,-1);
+    for (int i=0; i<n; ++i) lastWrite[out[i]]=i;
+    // which of the cases of a switch are evaluated is not known, so
+    // lifetimes are not analysed within them: results of a switch and
+    // its cases are held in their original slots
+    vector<bool> inSwitch=withinCases();
+    for (int i=0; i<n; ++i)
+      if (opcode[i]==OperationType::numOps) inSwitch[i]=true;
+
+    // convert to single assignment form. Value i is the result of
+    // instruction i, and values n and above are those held by flow
+    // variables before evaluation. Stock variable operands are not
+    // values, and are represented by their stock index.
+    struct Operand {bool flow; int id;};
+    vector<int> current(numSlots,-1), inputSlot;
+    vector<Operand> arg1(n), arg2(n), alias(n);
+    vector<bool> elided(n);
+    // pinned values are held in their original slot
+    auto pinned=[&](int v) {return v>=n || isRoot[out[v]] || inSwitch[v];};
+    auto operand=[&](int slot, bool flow)->Operand {
+      if (!flow) return Operand{false, slot};
+      if (current[slot]<0)
+        {
+          current[slot]=n+inputSlot.size();
+          inputSlot.push_back(slot);
+        }
+      int v=current[slot];
+      return v<n && elided[v]? alias[v]: Operand{true, v};
+    };
+    for (int i=0; i<n; ++i)
+      {
+        int nArgs=ops[i]->numArgs();
+        if (nArgs>0) arg1[i]=operand(in1[i], flags[i]&flow1);
+        if (nArgs>1) arg2[i]=operand(in2[i], flags[i]&flow2);
+        if (opcode[i]==OperationType::copy && !isRoot[out[i]] && !inSwitch[i])
+          {
+            // a pinned source may only be read in place of the copy
+            // if its slot is not subsequently overwritten
+            auto& a=arg1[i];
+            bool stable=!a.flow || !pinned(a.id) ||
+              (a.id<n? lastWrite[out[a.id]]==a.id: lastWrite[inputSlot[a.id-n]]<0);
+            if (stable)
+              {
+                elided[i]=true;
+                alias[i]=a;
+              }
+          }
+        current[out[i]]=i;
+      }
+
+    vector<int> lastUse(n+inputSlot.size(),-1);
+    for (int i=0; i<n; ++i)
+      if (!elided[i])
+        {
+          int nArgs=ops[i]->numArgs();
+          if (nArgs>0 && arg1[i].flow) lastUse[arg1[i].id]=i;
+          if (nArgs>1 && arg2[i].flow) lastUse[arg2[i].id]=i;
+        }
+
+    // linear scan allocation, lowest free slot first
+    std::set<int> freeSlots(slots.begin(), slots.end());
+    for (int r: roots) freeSlots.erase(r);
+    for (int s: inputSlot) freeSlots.erase(s);
+    for (int i=0; i<n; ++i)
+      if (inSwitch[i]) freeSlots.erase(out[i]);
+    vector<int> phys(n+inputSlot.size(),-1);
+    for (size_t k=0; k<inputSlot.size(); ++k) phys[n+k]=inputSlot[k];
+    for (int i=0; i<n; ++i)
+      {
+        if (elided[i]) continue;
+        int nArgs=ops[i]->numArgs();
+        // operands last used here are released first, so the result
+        // may overwrite an operand
+        if (nArgs>0 && arg1[i].flow && !pinned(arg1[i].id) && lastUse[arg1[i].id]==i)
+          freeSlots.insert(phys[arg1[i].id]);
+        if (nArgs>1 && arg2[i].flow && !pinned(arg2[i].id) && lastUse[arg2[i].id]==i)
+          freeSlots.insert(phys[arg2[i].id]);
+        if (pinned(i))
+          phys[i]=out[i];
+        else
+          {
+            if (freeSlots.empty()) return;
+            phys[i]=*freeSlots.begin();
+            freeSlots.erase(freeSlots.begin());
+            if (lastUse[i]<0) // result unused
+              freeSlots.insert(phys[i]);
+          }
+      }
+
+    EvalTape r;
+    auto slot=[&](const Operand& a) {return a.flow? phys[a.id]: a.id;};
+    for (int i=0; i<n; ++i)
+      if (!elided[i])
+        {
+          int nArgs=ops[i]->numArgs();
+          r.opcode.push_back(opcode[i]);
+          r.out.push_back(phys[i]);
+          r.in1.push_back(nArgs>0? slot(arg1[i]): phys[i]);
+          r.in2.push_back(nArgs>1? slot(arg2[i]): phys[i]);
+          r.flags.push_back((nArgs<1 || arg1[i].flow? flow1: 0) |
+                            (nArgs<2 || arg2[i].flow? flow2: 0));
+          r.value.push_back(value[i]);
+          r.ops.push_back(ops[i]);
+        }
+    r.deferChecks=deferChecks;
+    r.evalAllCases=evalAllCases;
+    *this=std::move(r);
+  }
+
+  void EvalTape::invalid(size_t i, const double fv[], const double sv[],
+                         size_t stride) const
+  {
+    auto& op=*ops[i];
+    if (op.state)
+      minsky().displayErrorItem(*op.state);
+    string msg="Invalid: "+OperationBase::typeName(opcode[i])+"(";
+    if (op.numArgs()>0)
+      msg+=str((flags[i]&flow1)? fv[stride*in1[i]]: sv[stride*in1[i]]);
+    if (op.numArgs()>1)
+      msg+=","+str((flags[i]&flow2)? fv[stride*in2[i]]: sv[stride*in2[i]]);
+    msg+=")";
+    throw error(msg.c_str());
+  }
+
+  void EvalTape::schedule(const shared_ptr<ThreadPool>& p, size_t g)
+  {
+    pool=p;
+    grain=max(g, size_t(1));
+    levelStart.clear();
+    inCase.clear();
+    if (!pool) return;
+
+    // level of each instruction, and of the last instruction to
+    // write, and to read, each flow variable
+    const size_t n=size();
+    vector<int> level(n), lastWrite, lastRead;
+    auto access=[&](vector<int>& v, int slot)->int& {
+      if (size_t(slot)>=v.size()) v.resize(slot+1,-1);
+      return v[slot];
+    };
+    int numLevels=0;
+    vector<int> reads, writes;
+    // a switch and its cases form a single unit, whose accesses are
+    // those of all its instructions
+    for (size_t i=0; i<n; i=spanEnd(i))
+      {
+        reads.clear();
+        writes.clear();
+        for (size_t j=i; j<spanEnd(i); ++j)
+          {
+            int nArgs=ops[j]->numArgs();
+            if (nArgs>0 && (flags[j]&flow1)) reads.push_back(in1[j]);
+            if (nArgs>1 && (flags[j]&flow2)) reads.push_back(in2[j]);
+            writes.push_back(out[j]);
+          }
+        int l=0;
+        // read after write
+        for (int r: reads) l=max(l, access(lastWrite,r)+1);
+        // write after write or read
+        for (int w: writes)
+          l=max(l, max(access(lastWrite,w), access(lastRead,w))+1);
+        for (int r: reads) access(lastRead,r)=max(access(lastRead,r), l);
+        for (int w: writes) access(lastWrite,w)=l;
+        fill(level.begin()+i, level.begin()+spanEnd(i), l);
+        numLevels=max(numLevels, l+1);
+      }
+
+    // stable counting sort of the instructions by level, which keeps
+    // the instructions of a switch together, and in order
+    levelStart.assign(numLevels+1, 0);
+    for (size_t i=0; i<n; ++i) ++levelStart[level[i]+1];
+    for (int l=0; l<numLevels; ++l) levelStart[l+1]+=levelStart[l];
+    vector<size_t> pos(levelStart.begin(), levelStart.end()-1), order(n);
+    for (size_t i=0; i<n; ++i) order[pos[level[i]]++]=i;
+
+    EvalTape r;
+    r.select(*this, order);
+    r.pool=pool;
+    r.grain=grain;
+    r.deferChecks=deferChecks;
+    r.evalAllCases=evalAllCases;
+    r.levelStart.swap(levelStart);
+    r.inCase=r.withinCases();
+    *this=std::move(r);
+  }
+
+  template <class F, class G> void EvalTape::forLevels(F f, G g) const
+  {
+    size_t begin, end, nChunks;
+    // chunks start at the next instruction outside the cases of a
+    // switch, so that a switch is evaluated by a single thread
+    auto boundary=[&](size_t c) {
+      size_t b=begin+(end-begin)*c/nChunks;
+      while (b<end && inCase[b]) ++b;
+      return b;
+    };
+    auto chunk=[&](size_t c) {f(boundary(c), boundary(c+1));};
+    for (size_t l=0; l+1<levelStart.size(); ++l)
+      {
+        begin=levelStart[l];
+        end=levelStart[l+1];
+        // a few chunks per thread balances the load
+        nChunks=min((end-begin)/grain, size_t(4*pool->size()));
+        if (nChunks>1)
+          // std::ref avoids allocating a copy of chunk
+          pool->parallelFor(nChunks, std::ref(chunk));
+        else
+          f(begin, end);
+        g(end);
+      }
+  }
+
+  void EvalTape::eval(double fv[], const double sv[], double t) const
+  {
+    if (deferChecks)
+      {
+        bool finite;
+        if (!pool || levelStart.empty())
+          finite=evalRange<false>(0, size(), fv, sv, t)==size();
+        else
+          {
+            std::atomic<bool> ok(true);
+            forLevels([&](size_t b, size_t e) {
+                if (evalRange<false>(b, e, fv, sv, t)<e) ok=false;
+              }, [](size_t) {});
+            finite=ok;
+          }
+        if (finite) return;
+        // rerun checked, to locate the problem
+      }
+
+    if (!pool || levelStart.empty())
+      {
+        size_t bad=evalRange<true>(0, size(), fv, sv, t);
+        if (bad<size()) invalid(bad, fv, sv);
+        return;
+      }
+    // the first invalid instruction of a level is reported once the
+    // level is complete, before its operands can be overwritten
+    std::atomic<size_t> bad(size());
+    forLevels([&](size_t b, size_t e) {
+        size_t i=evalRange<true>(b, e, fv, sv, t);
+        if (i<e)
+          for (size_t prev=bad; i<prev && !bad.compare_exchange_weak(prev, i);) {}
+      }, [&](size_t) {
+        if (bad<size()) invalid(bad, fv, sv);
+      });
+  }
+
+  template <bool Checked>
+  size_t EvalTape::evalRange(size_t begin, size_t n, double fv[], const double sv[],
+                             double t) const
+  {
+    // 0*r is NaN if, and only if, r is not finite, so summing these
+    // detects any non-finite result without a branch
+    double nonFinite=0;
+    for (size_t i=begin; i<n; ++i)
+      {
+        double x1=(flags[i]&flow1)? fv[in1[i]]: sv[in1[i]];
+        double x2=(flags[i]&flow2)? fv[in2[i]]: sv[in2[i]];
+        double& r=fv[out[i]];
+        size_t skip=0; // instructions to skip over
+        switch (opcode[i])
+          {
+          case OperationType::numOps: // switch
+            {
+              unsigned c=selectOp(i).selectCase(x1);
+              if (evalAllCases)
+                // for output only, so errors are ignored
+                for (unsigned k=0; k<selectOp(i).numCases(); ++k)
+                  if (k!=c)
+                    evalRange<false>(caseBegin(i,k), caseEnd(i,k), fv, sv, t);
+              size_t e=caseEnd(i,c), bad=evalRange<Checked>(caseBegin(i,c), e, fv, sv, t);
+              if (bad<e) return bad;
+              // r has been written by the case
+              skip=spanEnd(i)-i-1;
+              break;
+            }
+          case OperationType::constant: r=value[i]; break;
+          case OperationType::time: r=t; break;
+          case OperationType::copy: r=x1; break;
+          case OperationType::add: r=x1+x2; break;
+          case OperationType::subtract: r=x1-x2; break;
+          case OperationType::multiply: r=x1*x2; break;
+          case OperationType::divide: r=x1/x2; break;
+          case OperationType::min: r=std::min(x1,x2); break;
+          case OperationType::max: r=std::max(x1,x2); break;
+          case OperationType::lt: r=x1<x2; break;
+          case OperationType::le: r=x1<=x2; break;
+          case OperationType::eq: r=x1==x2; break;
+          case OperationType::and_: r=x1>0.5 && x2>0.5; break;
+          case OperationType::or_: r=x1>0.5 || x2>0.5; break;
+          case OperationType::not_: r=x1<=0.5; break;
+          case OperationType::sqrt: r=::sqrt(x1); break;
+          case OperationType::exp: r=::exp(x1); break;
+          case OperationType::ln: r=::log(x1); break;
+          case OperationType::log: r=::log(x1)/::log(x2); break;
+          case OperationType::pow: r=::pow(x1,x2); break;
+          case OperationType::sin: r=::sin(x1); break;
+          case OperationType::cos: r=::cos(x1); break;
+          case OperationType::tan: r=::tan(x1); break;
+          case OperationType::asin: r=::asin(x1); break;
+          case OperationType::acos: r=::acos(x1); break;
+          case OperationType::atan: r=::atan(x1); break;
+          case OperationType::sinh: r=::sinh(x1); break;
+          case OperationType::cosh: r=::cosh(x1); break;
+          case OperationType::tanh: r=::tanh(x1); break;
+          case OperationType::abs: r=::fabs(x1); break;
+          case OperationType::floor: r=::floor(x1); break;
+          case OperationType::frac: r=x1-::floor(x1); break;
+          default:
+            // stateful operations (eg data) are delegated to the EvalOp
+            r=ops[i]->evaluate(x1,x2);
+            break;
+          }
+        if (Checked)
+          {
+            if (!isfinite(r))
+              return i;
+          }
+        else
+          nonFinite+=0*r;
+        i+=skip;
+      }
+    return nonFinite==0? n: begin;
+  }
+
+  template <size_t N>
+  void EvalTape::evalLanes(double fv[], const double sv[], double t) const
+  {
+    evalLanesRange<N>(0, size(), fv, sv, t, (1U<<N)-1);
+  }
+
+  template <size_t N>
+  void EvalTape::evalLanesRange(size_t begin, size_t n, double fv[], const double sv[],
+                                double t, unsigned mask) const
+  {
+    for (size_t i=begin; i<n; ++i)
+      {
+        // operands are copied to locals, as the output may alias an
+        // operand, which would otherwise defeat vectorisation
+        double x1[N], x2[N], r[N];
+        const double* a1=((flags[i]&flow1)? fv: sv)+N*in1[i];
+        const double* a2=((flags[i]&flow2)? fv: sv)+N*in2[i];
+        for (size_t l=0; l<N; ++l) {x1[l]=a1[l]; x2[l]=a2[l];}
+
+        size_t skip=0; // instructions to skip over
+#define LANES(expr) for (size_t l=0; l<N; ++l) r[l]=(expr); break
+        switch (opcode[i])
+          {
+          case OperationType::numOps: // switch
+            {
+              // evaluate each case selected by some lane, for the
+              // lanes selecting it
+              unsigned c[N];
+              const double* o=fv+N*out[i];
+              for (size_t l=0; l<N; ++l)
+                {
+                  c[l]=selectOp(i).selectCase(x1[l]);
+                  r[l]=o[l];
+                }
+              for (unsigned k=0; k<selectOp(i).numCases(); ++k)
+                {
+                  unsigned m=0;
+                  for (size_t l=0; l<N; ++l)
+                    if (c[l]==k) m|=1U<<l;
+                  if ((m&=mask)==0) continue;
+                  evalLanesRange<N>(caseBegin(i,k), caseEnd(i,k), fv, sv, t, m);
+                  for (size_t l=0; l<N; ++l)
+                    if (m>>l&1) r[l]=o[l];
+                }
+              skip=spanEnd(i)-i-1;
+              break;
+            }
+          case OperationType::constant: LANES(value[i]);
+          case OperationType::time: LANES(t);
+          case OperationType::copy: LANES(x1[l]);
+          case OperationType::add: LANES(x1[l]+x2[l]);
+          case OperationType::subtract: LANES(x1[l]-x2[l]);
+          case OperationType::multiply: LANES(x1[l]*x2[l]);
+          case OperationType::divide: LANES(x1[l]/x2[l]);
+          case OperationType::min: LANES(std::min(x1[l],x2[l]));
+          case OperationType::max: LANES(std::max(x1[l],x2[l]));
+          case OperationType::lt: LANES(x1[l]<x2[l]);
+          case OperationType::le: LANES(x1[l]<=x2[l]);
+          case OperationType::eq: LANES(x1[l]==x2[l]);
+          case OperationType::and_: LANES(x1[l]>0.5 && x2[l]>0.5);
+          case OperationType::or_: LANES(x1[l]>0.5 || x2[l]>0.5);
+          case OperationType::not_: LANES(x1[l]<=0.5);
+          case OperationType::sqrt: LANES(::sqrt(x1[l]));
+          case OperationType::exp: LANES(::exp(x1[l]));
+          case OperationType::ln: LANES(::log(x1[l]));
+          case OperationType::log: LANES(::log(x1[l])/::log(x2[l]));
+          case OperationType::pow: LANES(::pow(x1[l],x2[l]));
+          case OperationType::sin: LANES(::sin(x1[l]));
+          case OperationType::cos: LANES(::cos(x1[l]));
+          case OperationType::tan: LANES(::tan(x1[l]));
+          case OperationType::asin: LANES(::asin(x1[l]));
+          case OperationType::acos: LANES(::acos(x1[l]));
+          case OperationType::atan: LANES(::atan(x1[l]));
+          case OperationType::sinh: LANES(::sinh(x1[l]));
+          case OperationType::cosh: LANES(::cosh(x1[l]));
+          case OperationType::tanh: LANES(::tanh(x1[l]));
+          case OperationType::abs: LANES(::fabs(x1[l]));
+          case OperationType::floor: LANES(::floor(x1[l]));
+          case OperationType::frac: LANES(x1[l]-::floor(x1[l]));
+          default: LANES(ops[i]->evaluate(x1[l],x2[l]));
+          }
+#undef LANES
+
+        double* o=fv+N*out[i];
+        bool finite=true;
+        for (size_t l=0; l<N; ++l)
+          {
+            o[l]=r[l];
+            finite&=isfinite(r[l]) || !(mask>>l&1);
+          }
+        if (!finite)
+          for (size_t l=0; l<N; ++l)
+            if (!isfinite(r[l]) && (mask>>l&1))
+              invalid(i, fv+l, sv+l, N);
+        i+=skip;
+      }
+  }
+
+  template void EvalTape::evalLanes<4>(double[], const double[], double) const;
+  template void EvalTape::evalLanes<8>(double[], const double[], double) const;
+
+  void EvalTape::deriv(double df[], const double ds[],
+                       const double sv[], const double fv[]) const
+  {
+    if (deferChecks)
+      {
+        std::atomic<bool> ok(true);
+        if (!pool || levelStart.empty())
+          ok=derivRange<false>(0, size(), df, ds, sv, fv);
+        else
+          forLevels([&](size_t b, size_t e) {
+              if (!derivRange<false>(b, e, df, ds, sv, fv)) ok=false;
+            }, [](size_t) {});
+        if (ok) return;
+        // rerun checked, to locate the problem
+      }
+
+    if (!pool || levelStart.empty())
+      derivRange<true>(0, size(), df, ds, sv, fv);
+    else
+      forLevels([&](size_t b, size_t e) {derivRange<true>(b, e, df, ds, sv, fv);},
+                [](size_t) {});
+  }
+
+  template <bool Checked>
+  bool EvalTape::derivRange(size_t begin, size_t n, double df[], const double ds[],
+                            const double sv[], const double fv[]) const
+  {
+    double nonFinite=0;
+    for (size_t i=begin; i<n; ++i)
+      {
+        double x1=(flags[i]&flow1)? fv[in1[i]]: sv[in1[i]];
+        double x2=(flags[i]&flow2)? fv[in2[i]]: sv[in2[i]];
+        double dx1=(flags[i]&flow1)? df[in1[i]]: ds[in1[i]];
+        double dx2=(flags[i]&flow2)? df[in2[i]]: ds[in2[i]];
+        double& r=df[out[i]];
+        size_t skip=0; // instructions to skip over
+        switch (opcode[i])
+          {
+          case OperationType::numOps: // switch
+            {
+              // the derivative of the case selected by the evaluation
+              unsigned c=selectOp(i).selectCase(x1);
+              if (!derivRange<Checked>(caseBegin(i,c), caseEnd(i,c), df, ds, sv, fv))
+                return false;
+              skip=spanEnd(i)-i-1;
+              break;
+            }
+          case OperationType::constant: case OperationType::time:
+            r=0; break;
+          case OperationType::copy: r=dx1; break;
+          case OperationType::add: r=dx1+dx2; break;
+          case OperationType::subtract: r=dx1-dx2; break;
+          case OperationType::multiply:
+            r=(dx1!=0? dx1*x2: 0) + (dx2!=0? dx2*x1: 0); break;
+          case OperationType::divide:
+            r=(dx1!=0? dx1/x2: 0) + (dx2!=0? -dx2*x1/(x2*x2): 0); break;
+          default:
+            {
+              auto& op=*ops[i];
+              switch (op.numArgs())
+                {
+                case 0:
+                  r=0;
+                  break;
+                case 1:
+                  r = dx1!=0? dx1 * op.d1(x1,0): 0;
+                  break;
+                case 2:
+                  r = (dx1!=0? dx1 * op.d1(x1,x2): 0) +
+                    (dx2!=0? dx2 * op.d2(x1,x2): 0);
+                  break;
+                }
+            }
+          }
+        if (!Checked)
+          nonFinite+=0*r;
+        else if (!isfinite(r))
+          throw error("Invalid operation detected on a %s operation",
+                      OperationBase::typeName(opcode[i]).c_str());
+        i+=skip;
+      }
+    return nonFinite==0;
+  }
+}
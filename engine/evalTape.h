@@ -0,0 +1,201 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef EVALTAPE_H
+#define EVALTAPE_H
+
+#include "evalOp.h"
+#include <memory>
+#include <vector>
+
+namespace minsky
+{
+  class ThreadPool;
+
+  /**
+     A flattened, struct-of-arrays form of an EvalOpVector. Each
+     instruction is described by an opcode and its operand indices,
+     stored in parallel arrays, so that the inner evaluation loop is a
+     single switch over contiguous data, rather than a sequence of
+     virtual calls through individually heap allocated EvalOps.
+
+     A switch is a SelectEvalOp instruction, whose opcode is numOps,
+     followed by the blocks of instructions computing each case. Only
+     the block of the selected case is evaluated.
+  */
+  class EvalTape
+  {
+  public:
+    /// bit flags indicating whether an operand refers to a flow variable
+    enum Flags {flow1=1, flow2=2};
+
+    /// @{ instruction arrays, all of length size()
+    std::vector<OperationType::Type> opcode;
+    std::vector<int> out, in1, in2;
+    std::vector<unsigned char> flags;
+    /// value of constant instructions (unused otherwise)
+    std::vector<double> value;
+    /// @}
+
+    /// originating EvalOps, used for ops requiring state (eg data),
+    /// and for diagnostics
+    EvalOpVector ops;
+
+    /// if true, eval and deriv do not check the result of each
+    /// instruction, but detect any non-finite result once the
+    /// evaluation is complete, and only then rerun the checked
+    /// evaluation to locate and report it. Errors are reported
+    /// identically, but the common case avoids a branch per
+    /// instruction.
+    bool deferChecks=false;
+    /// if true, eval also evaluates the unselected cases of switches,
+    /// without checking their results, before the selected case, so
+    /// that intermediate values computed within cases, as displayed on
+    /// the canvas, stay current. Only needed for the tape whose values
+    /// are output.
+    bool evalAllCases=false;
+
+    /// build the tape from a sequence of EvalOps
+    void compile(const EvalOpVector&);
+    void clear();
+
+    /// indices, in order, of the instructions needed to compute flow
+    /// variables \a roots (liveness analysis)
+    std::vector<size_t> liveInstructions(const std::vector<int>& roots) const;
+    /// build the tape from the instructions \a instrs of \a tape
+    void select(const EvalTape& tape, const std::vector<size_t>& instrs);
+    /**
+       Eliminate copy instructions by reading their source directly,
+       and reassign the flow variables holding intermediate results
+       to the lowest free slot of \a slots, in order of first use,
+       reusing slots once their values are no longer needed. Flow
+       variables \a roots, those read before being written, and those
+       written by a switch or its cases, keep their slots. Only valid
+       where intermediate results are not otherwise observed, as for a
+       tape computing just \a roots, whose remaining flow variables
+       are recomputed before output.
+       The tape is left unchanged if \a slots is insufficient.
+    */
+    void allocateSlots(const std::vector<int>& roots, const std::vector<int>& slots);
+
+    /**
+       Reorder the instructions into dependency levels, each level
+       reading only values written by earlier levels (or present
+       before evaluation), and not writing any variable accessed
+       elsewhere in the level, so that the instructions of a level
+       may be evaluated concurrently. A switch and its cases are
+       placed in a single level, as a unit accessing every variable
+       accessed by any of its cases. Subsequently, eval and deriv
+       distribute each level of at least \a grain instructions across
+       \a pool, with a barrier between levels, and evaluate smaller
+       levels serially. A null \a pool leaves the tape serial.
+    */
+    void schedule(const std::shared_ptr<ThreadPool>& pool, size_t grain=256);
+    /// start of each dependency level, terminated by size(). Empty
+    /// if the tape has not been scheduled.
+    const std::vector<size_t>& levels() const {return levelStart;}
+    /// thread pool used for evaluation, null if serial
+    const std::shared_ptr<ThreadPool>& threadPool() const {return pool;}
+
+    /// the switch at instruction \a i
+    const SelectEvalOp& selectOp(size_t i) const
+    {return static_cast<const SelectEvalOp&>(*ops[i]);}
+    /// end of the instructions belonging to instruction \a i, ie
+    /// including the case blocks of a switch
+    size_t spanEnd(size_t i) const {
+      return opcode[i]==OperationType::numOps? i+1+selectOp(i).caseEnd.back(): i+1;
+    }
+    /// @{ first and last instruction of case \a c of switch \a i
+    size_t caseBegin(size_t i, unsigned c) const
+    {return i+1+(c>0? selectOp(i).caseEnd[c-1]: 0);}
+    size_t caseEnd(size_t i, unsigned c) const
+    {return i+1+selectOp(i).caseEnd[c];}
+    /// @}
+    /// whether each instruction lies within a case of a switch
+    std::vector<bool> withinCases() const;
+
+    /// instructions, outside the cases of switches, whose result is
+    /// a discontinuous function of their operands: comparisons,
+    /// logical operations, floor, frac and switches
+    std::vector<size_t> discontinuities() const;
+    /// which side of its discontinuities instruction \a i lies,
+    /// given variable values \a fv and \a sv following eval. The
+    /// result of the instruction is continuous between two states
+    /// of the same regime.
+    double regime(size_t i, const double fv[], const double sv[]) const;
+
+    size_t size() const {return opcode.size();}
+    bool empty() const {return opcode.empty();}
+
+    /// evaluate the tape on stock variables \a sv, updating flow
+    /// variables \a fv, with time value \a t
+    /// @throw ecolab::error if a non-finite value is produced
+    void eval(double fv[], const double sv[], double t) const;
+
+    /// evaluate the tape on \a N independent sets of variables at
+    /// once. \a fv and \a sv are laid out [variable][lane], ie the
+    /// value of variable \c i in lane \c l is at \c N*i+l, so that
+    /// each instruction becomes a loop over contiguous values that
+    /// the compiler can vectorise. Instantiated for N=4 and 8.
+    /// @throw ecolab::error if a non-finite value is produced in any lane
+    template <size_t N>
+    void evalLanes(double fv[], const double sv[], double t) const;
+
+    /// forward mode derivative, with the same semantics as EvalOpBase::deriv
+    void deriv(double df[], const double ds[],
+               const double sv[], const double fv[]) const;
+
+  private:
+    std::shared_ptr<ThreadPool> pool;
+    std::vector<size_t> levelStart;
+    size_t grain=0;
+    /// withinCases(), if scheduled, so that levels are divided
+    /// between threads only at the start of a switch's span
+    std::vector<bool> inCase;
+
+    /// evaluate instructions [\a begin, \a end)
+    /// @return \a end if all results are finite, otherwise the first
+    /// instruction producing a non-finite value if \a Checked, or
+    /// just some instruction of the range if not
+    template <bool Checked>
+    size_t evalRange(size_t begin, size_t end, double fv[], const double sv[],
+                     double t) const;
+    /// @return true if all results are finite. If \a Checked, a
+    /// non-finite result throws instead.
+    template <bool Checked>
+    bool derivRange(size_t begin, size_t end, double df[], const double ds[],
+                    const double sv[], const double fv[]) const;
+    /// evaluate instructions [\a begin, \a end) in the lanes of \a
+    /// mask. Non-finite values in other lanes are ignored.
+    template <size_t N>
+    void evalLanesRange(size_t begin, size_t end, double fv[], const double sv[],
+                        double t, unsigned mask) const;
+
+    /// apply \a f(begin,end) to chunks of instructions, level by
+    /// level, in parallel where worthwhile, calling \a g(end) on the
+    /// calling thread once each level is complete
+    template <class F, class G> void forLevels(F f, G g) const;
+
+    /// report on, and throw, non-finite result of instruction \a i.
+    /// Variables are located at multiples of \a stride
+    void invalid(size_t i, const double fv[], const double sv[],
+                 size_t stride=1) const;
+  };
+}
+
+#endif
@@ -0,0 +1,457 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "jit.h"
+#include <ecolab_epilogue.h>
+
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <set>
+#include <stdlib.h>
+#include <math.h>
+
+#ifndef _WIN32
+#include <dlfcn.h>
+#include <errno.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+extern char** environ;
+#endif
+
+using namespace std;
+
+namespace minsky
+{
+  struct JitEquations::Library
+  {
+    void* handle=nullptr;
+    ~Library() {
+#ifndef _WIN32
+      if (handle) dlclose(handle);
+#endif
+    }
+  };
+
+  namespace
+  {
+    string operand(const EvalTape& tape, size_t i, int arg, const char* fv="fv", const char* sv="sv")
+    {
+      ostringstream o;
+      if (arg==1)
+        o<<((tape.flags[i]&EvalTape::flow1)? fv: sv)<<"["<<tape.in1[i]<<"]";
+      else
+        o<<((tape.flags[i]&EvalTape::flow2)? fv: sv)<<"["<<tape.in2[i]<<"]";
+      return o.str();
+    }
+
+    string literal(double x)
+    {
+      ostringstream o;
+      o<<setprecision(17)<<x;
+      if (o.str().find_first_of(".e")==string::npos) o<<".0";
+      return o.str();
+    }
+
+    /// C++ expression for the value of instruction \a i in terms of
+    /// x1 and x2. Empty if not compilable
+    string valueExpr(const EvalTape& tape, size_t i)
+    {
+      switch (tape.opcode[i])
+        {
+        case OperationType::constant: return literal(tape.value[i]);
+        case OperationType::time: return "t";
+        case OperationType::copy: return "x1";
+        case OperationType::add: return "x1+x2";
+        case OperationType::subtract: return "x1-x2";
+        case OperationType::multiply: return "x1*x2";
+        case OperationType::divide: return "x1/x2";
+        // same NaN semantics as std::min/max
+        case OperationType::min: return "x2<x1? x2: x1";
+        case OperationType::max: return "x1<x2? x2: x1";
+        case OperationType::lt: return "double(x1<x2)";
+        case OperationType::le: return "double(x1<=x2)";
+        case OperationType::eq: return "double(x1==x2)";
+        case OperationType::and_: return "double(x1>0.5 && x2>0.5)";
+        case OperationType::or_: return "double(x1>0.5 || x2>0.5)";
+        case OperationType::not_: return "double(x1<=0.5)";
+        case OperationType::sqrt: return "sqrt(x1)";
+        case OperationType::exp: return "exp(x1)";
+        case OperationType::ln: return "log(x1)";
+        case OperationType::log: return "log(x1)/log(x2)";
+        case OperationType::pow: return "pow(x1,x2)";
+        case OperationType::sin: return "sin(x1)";
+        case OperationType::cos: return "cos(x1)";
+        case OperationType::tan: return "tan(x1)";
+        case OperationType::asin: return "asin(x1)";
+        case OperationType::acos: return "acos(x1)";
+        case OperationType::atan: return "atan(x1)";
+        case OperationType::sinh: return "sinh(x1)";
+        case OperationType::cosh: return "cosh(x1)";
+        case OperationType::tanh: return "tanh(x1)";
+        case OperationType::abs: return "fabs(x1)";
+        case OperationType::floor: return "floor(x1)";
+        case OperationType::frac: return "x1-floor(x1)";
+        // eg data, left to the interpreter. Switches are emitted
+        // as control flow by emitRange
+        default: return "";
+        }
+    }
+
+    /// @{ C++ expressions for the partial derivatives of instruction
+    /// \a i. "!" indicates the operation is not differentiable
+    string d1Expr(OperationType::Type op)
+    {
+      switch (op)
+        {
+        case OperationType::constant: case OperationType::time: return "0";
+        case OperationType::copy: case OperationType::add:
+        case OperationType::subtract: return "1";
+        case OperationType::multiply: return "x2";
+        case OperationType::divide: return "1/x2";
+        case OperationType::min: return "double(x1<=x2)";
+        case OperationType::max: return "double(x1>x2)";
+        case OperationType::sqrt: return "0.5/sqrt(x1)";
+        case OperationType::exp: return "exp(x1)";
+        case OperationType::ln: return "1/x1";
+        case OperationType::log: return "1/(x1*log(x2))";
+        case OperationType::pow: return "pow(x1,x2)*x2/x1";
+        case OperationType::sin: return "cos(x1)";
+        case OperationType::cos: return "-sin(x1)";
+        case OperationType::tan: return "1/(cos(x1)*cos(x1))";
+        case OperationType::asin: return "1/sqrt(1-x1*x1)";
+        case OperationType::acos: return "-1/sqrt(1-x1*x1)";
+        case OperationType::atan: return "1/(1+x1*x1)";
+        case OperationType::sinh: return "cosh(x1)";
+        case OperationType::cosh: return "sinh(x1)";
+        case OperationType::tanh: return "1/(cosh(x1)*cosh(x1))";
+        case OperationType::abs: return "(x1<0? -1.0: 1.0)";
+        default: return "!";
+        }
+    }
+
+    string d2Expr(OperationType::Type op)
+    {
+      switch (op)
+        {
+        case OperationType::add: return "1";
+        case OperationType::subtract: return "-1";
+        case OperationType::multiply: return "x1";
+        case OperationType::divide: return "-x1/(x2*x2)";
+        case OperationType::min: return "double(x1>x2)";
+        case OperationType::max: return "double(x1<=x2)";
+        case OperationType::log: return "-log(x1)/(x2*log(x2)*log(x2))";
+        case OperationType::pow: return "pow(x1,x2)*log(x1)";
+        default: return "0";
+        }
+    }
+    /// @}
+
+    /// C++ expression for the case of switch \a i selected by x1, as
+    /// SelectEvalOp::selectCase
+    string caseExpr(const EvalTape& tape, size_t i)
+    {
+      unsigned last=tape.selectOp(i).numCases()-1;
+      ostringstream o;
+      o<<"x1<1? 0: x1<"<<last<<"? unsigned(x1): "<<last<<"u";
+      return o.str();
+    }
+
+    /**
+       emit the instructions [\a begin, \a end) of \a tape, evaluating
+       only the selected case of each switch. \a emit(i,indent) emits
+       instruction \a i, other than a switch, after x1 has been set to
+       its first operand.
+    */
+    template <class F>
+    void emitRange(ostream& o, const EvalTape& tape, size_t begin, size_t end,
+                   const string& indent, F emit)
+    {
+      for (size_t i=begin; i<end; i=tape.spanEnd(i))
+        {
+          o<<indent<<"x1="<<operand(tape,i,1)<<";";
+          if (tape.opcode[i]!=OperationType::numOps)
+            {
+              emit(i, indent);
+              continue;
+            }
+          o<<"\n"<<indent<<"switch ("<<caseExpr(tape,i)<<")\n"<<indent<<"  {\n";
+          for (unsigned c=0; c<tape.selectOp(i).numCases(); ++c)
+            {
+              o<<indent<<"  case "<<c<<":\n";
+              emitRange(o, tape, tape.caseBegin(i,c), tape.caseEnd(i,c), indent+"    ", emit);
+              o<<indent<<"    break;\n";
+            }
+          o<<indent<<"  }\n";
+        }
+    }
+
+    /// emit a check that all flow variables written by the tape are finite
+    void finiteCheck(ostream& o, const std::set<int>& written, const char* fv)
+    {
+      if (written.empty()) return;
+      o<<"  static const int written[]={";
+      for (auto i=written.begin(); i!=written.end(); ++i)
+        o<<(i==written.begin()? "": ",")<<*i;
+      o<<"};\n";
+      o<<"  for (unsigned i=0; i<sizeof(written)/sizeof(written[0]); ++i)\n";
+      o<<"    if (!isfinite("<<fv<<"[written[i]])) return 1;\n";
+    }
+
+    /// emit the Godley matrix product \a result=M*\a fv as one dot
+    /// product per stock row, summed in the same order as EvalGodley::eval
+    void godleyRows(ostream& o, const EvalGodley& godley, const char* result, const char* fv)
+    {
+      for (size_t r=0; r<godley.numRows(); ++r)
+        {
+          o<<"  "<<result<<"["<<godley.rowStock()[r]<<"]=";
+          for (int k=godley.rowStart()[r]; k<godley.rowStart()[r+1]; ++k)
+            o<<(k>godley.rowStart()[r]? "+": "")<<fv<<"["<<godley.flowIdx()[k]
+             <<"]*"<<literal(godley.coefs()[k]);
+          o<<";\n";
+        }
+    }
+
+    std::mutex cacheMutex;
+    std::map<size_t, std::weak_ptr<JitEquations::Library> > loaded;
+
+#ifndef _WIN32
+    /// true if \a path is a directory (or regular file, if not \a
+    /// dir) owned by this user, and not writable (nor for
+    /// directories, readable) by anyone else, so that it cannot have
+    /// been planted or altered by another user
+    bool privatelyOwned(const string& path, bool dir)
+    {
+      struct stat s;
+      return lstat(path.c_str(), &s)==0 &&
+        (dir? S_ISDIR(s.st_mode): S_ISREG(s.st_mode)) &&
+        s.st_uid==geteuid() && (s.st_mode&(dir? 077: 022))==0;
+    }
+
+    /// per user directory holding compiled equations, created if
+    /// necessary
+    string cacheDirectory()
+    {
+      string dir;
+      if (auto xdg=getenv("XDG_CACHE_HOME"))
+        if (*xdg=='/') dir=xdg;
+      if (dir.empty())
+        if (auto home=getenv("HOME"))
+          if (*home=='/') dir=string(home)+"/.cache";
+      if (dir.empty())
+        dir=(boost::filesystem::temp_directory_path()/
+             ("minsky-jit-"+to_string(geteuid()))).string();
+      else
+        {
+          boost::system::error_code ec;
+          boost::filesystem::create_directories(dir, ec);
+          dir+="/minsky-jit";
+        }
+      if (mkdir(dir.c_str(), 0700)!=0 && errno!=EEXIST)
+        throw error("unable to create JIT cache directory %s",dir.c_str());
+      if (!privatelyOwned(dir, true))
+        throw error("JIT cache directory %s is not private to this user",dir.c_str());
+      return dir;
+    }
+
+    /// create a uniquely named file from \a name, which ends in
+    /// XXXXXX followed by \a suffix, replacing \a name by the name
+    /// created. Returns an open descriptor for it.
+    int uniqueFile(string& name, const string& suffix)
+    {
+      name+="-XXXXXX"+suffix;
+      int fd=mkstemps(&name[0], suffix.size());
+      if (fd<0)
+        throw error("unable to create %s",name.c_str());
+      return fd;
+    }
+
+    /// compile \a src into the shared object \a obj, without
+    /// involving a shell, with diagnostics written to \a logFd
+    bool runCompiler(const string& src, const string& obj, int logFd)
+    {
+      const char* cxx=getenv("CXX");
+      if (!cxx || !*cxx) cxx="c++";
+      vector<string> args{cxx, "-O2", "-shared", "-fPIC", "-o", obj, src};
+      vector<char*> argv;
+      for (auto& a: args) argv.push_back(&a[0]);
+      argv.push_back(nullptr);
+
+      posix_spawn_file_actions_t actions;
+      posix_spawn_file_actions_init(&actions);
+      posix_spawn_file_actions_adddup2(&actions, logFd, 1);
+      posix_spawn_file_actions_adddup2(&actions, logFd, 2);
+      pid_t pid;
+      int err=posix_spawnp(&pid, cxx, &actions, nullptr, &argv[0], environ);
+      posix_spawn_file_actions_destroy(&actions);
+      if (err) return false;
+      int status;
+      while (waitpid(pid, &status, 0)<0)
+        if (errno!=EINTR) return false;
+      return WIFEXITED(status) && WEXITSTATUS(status)==0;
+    }
+#endif
+  }
+
+  string JitEquations::source(const EvalTape& tape, const EvalGodley& godley,
+                              const vector<Integral>& integrals, size_t numStocks)
+  {
+    for (size_t i=0; i<tape.size(); ++i)
+      if ((valueExpr(tape,i).empty() && tape.opcode[i]!=OperationType::numOps) ||
+          (tape.opcode[i]==OperationType::constant && !isfinite(tape.value[i])))
+        return "";
+    for (auto& i: integrals)
+      if (i.input.idx()<0)
+        return "";
+
+    // values computed within the cases of switches are checked as
+    // they are computed, as the interpreter does, as those of
+    // unselected cases are stale. Otherwise slots reused within the
+    // tape are checked before being overwritten, and the rest at
+    // the end.
+    auto inCase=tape.withinCases();
+    std::set<int> written;
+    for (size_t i=0; i<tape.size(); ++i)
+      if (!inCase[i]) written.insert(tape.out[i]);
+    vector<bool> check(tape.size());
+    {
+      std::set<int> later;
+      for (size_t i=tape.size(); i-->0;)
+        check[i]=!later.insert(tape.out[i]).second || inCase[i];
+    }
+    ostringstream o;
+    o<<"// generated by Minsky - do not edit\n";
+    o<<"#include <math.h>\n\n";
+
+    o<<"extern \"C\" int minsky_rhs(double t, const double* sv, double* result, double* fv)\n{\n";
+    o<<"  double x1, x2;\n";
+    emitRange(o, tape, 0, tape.size(), "  ", [&](size_t i, const string& indent) {
+        o<<" x2="<<operand(tape,i,2)<<"; fv["<<tape.out[i]<<"]="<<valueExpr(tape,i)<<";\n";
+        if (check[i])
+          o<<indent<<"if (!isfinite(fv["<<tape.out[i]<<"])) return 1;\n";
+      });
+    o<<"  (void)x1; (void)x2; (void)t;\n";
+    o<<"  for (unsigned i=0; i<"<<numStocks<<"; ++i) result[i]=0;\n";
+    godleyRows(o, godley, "result", "fv");
+    for (auto& i: integrals)
+      o<<"  result["<<i.stock.idx()<<"]="<<(i.input.isFlowVar()? "fv": "sv")
+       <<"["<<i.input.idx()<<"];\n";
+    finiteCheck(o, written, "fv");
+    o<<"  return 0;\n}\n\n";
+
+    o<<"extern \"C\" int minsky_deriv(double t, const double* sv, const double* fv,\n"
+     <<"                              const double* ds, double* df, double* d)\n{\n";
+    o<<"  double x1, x2, dx1, dx2;\n";
+    // the derivative of a switch is that of the case selected by
+    // the values of the evaluation
+    emitRange(o, tape, 0, tape.size(), "  ", [&](size_t i, const string& indent) {
+        o<<" x2="<<operand(tape,i,2)
+         <<"; dx1="<<operand(tape,i,1,"df","ds")<<"; dx2="<<operand(tape,i,2,"df","ds")<<";\n";
+        string d1=d1Expr(tape.opcode[i]), d2=d2Expr(tape.opcode[i]);
+        if (d1=="0")
+          o<<indent<<"df["<<tape.out[i]<<"]=0;\n";
+        else if (d1=="!")
+          // defer to the interpreter to report the error
+          o<<indent<<"if (dx1!=0) return 1;\n"<<indent<<"df["<<tape.out[i]<<"]=0;\n";
+        else
+          o<<indent<<"df["<<tape.out[i]<<"]=(dx1!=0? dx1*("<<d1<<"): 0)"
+           <<(d2=="0"? string(): "+(dx2!=0? dx2*("+d2+"): 0)")<<";\n";
+        if (check[i])
+          o<<indent<<"if (!isfinite(df["<<tape.out[i]<<"])) return 1;\n";
+      });
+    o<<"  (void)x1; (void)x2; (void)dx1; (void)dx2; (void)t;\n";
+    finiteCheck(o, written, "df");
+    o<<"  for (unsigned i=0; i<"<<numStocks<<"; ++i) d[i]=0;\n";
+    godleyRows(o, godley, "d", "df");
+    for (auto& i: integrals)
+      o<<"  d["<<i.stock.idx()<<"]="<<(i.input.isFlowVar()? "df": "ds")
+       <<"["<<i.input.idx()<<"];\n";
+    o<<"  return 0;\n}\n";
+    return o.str();
+  }
+
+  std::shared_ptr<JitEquations> JitEquations::compile
+  (const EvalTape& tape, const EvalGodley& godley,
+   const vector<Integral>& integrals, size_t numStocks)
+  {
+#ifdef _WIN32
+    return nullptr;
+#else
+    string src=source(tape, godley, integrals, numStocks);
+    if (src.empty()) return nullptr;
+
+    std::shared_ptr<JitEquations> r(new JitEquations);
+    r->m_hash=std::hash<string>()(src);
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    r->lib=loaded[r->m_hash].lock();
+    if (!r->lib)
+      {
+        string stem=cacheDirectory()+"/minsky-"+to_string(r->m_hash);
+        string so=stem+".so";
+
+        if (!privatelyOwned(so, false))
+          {
+            // write to unique files, then rename, so concurrent
+            // processes neither clobber each other's files, nor load
+            // a partially written object
+            string srcName=stem, objName=stem, logName=stem;
+            close(uniqueFile(objName, ".so"));
+            close(uniqueFile(srcName, ".cc"));
+            {
+              ofstream f(srcName);
+              f<<src;
+            }
+            int logFd=uniqueFile(logName, ".log");
+            bool compiled=runCompiler(srcName, objName, logFd);
+            close(logFd);
+            rename(srcName.c_str(), (stem+".cc").c_str());
+            if (!compiled)
+              {
+                remove(objName.c_str());
+                rename(logName.c_str(), (stem+".log").c_str());
+                throw error("JIT compilation failed: see %s.log",stem.c_str());
+              }
+            remove(logName.c_str());
+            if (rename(objName.c_str(), so.c_str())!=0)
+              {
+                remove(objName.c_str());
+                throw error("unable to install %s",so.c_str());
+              }
+          }
+
+        r->lib.reset(new Library);
+        r->lib->handle=dlopen(so.c_str(), RTLD_NOW|RTLD_LOCAL);
+        if (!r->lib->handle)
+          throw error("failed to load %s: %s",so.c_str(),dlerror());
+        loaded[r->m_hash]=r->lib;
+      }
+
+    r->m_rhs=reinterpret_cast<RHS>(dlsym(r->lib->handle, "minsky_rhs"));
+    r->m_deriv=reinterpret_cast<Deriv>(dlsym(r->lib->handle, "minsky_deriv"));
+    if (!r->m_rhs || !r->m_deriv)
+      throw error("JIT object is missing entry points");
+    return r;
+#endif
+  }
+}
@@ -0,0 +1,89 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef JIT_H
+#define JIT_H
+
+#include "evalTape.h"
+#include "evalGodley.h"
+#include "integral.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace minsky
+{
+  /**
+     Native code version of the system of equations. C++ source is
+     generated from the evaluation tape, Godley tables and integrals,
+     compiled by the system compiler into a shared object and loaded
+     with dlopen. Compiled objects are cached (on disk and in process)
+     keyed by a hash of the generated source, so rebuilding an
+     unchanged model is cheap.
+
+     The generated functions do not produce diagnostics - if they
+     report a non-finite value, the caller should rerun the
+     interpreted path, which will throw the appropriate error.
+  */
+  class JitEquations
+  {
+  public:
+    /// signature of the generated right hand side function. Returns
+    /// nonzero if a non-finite value was produced
+    typedef int (*RHS)(double t, const double* sv, double* result, double* fv);
+    /// signature of the generated directional derivative function:
+    /// given stock direction \a ds, computes flow variable
+    /// derivatives \a df and stock derivatives \a d. Returns nonzero
+    /// if a non-finite value was produced, or a non-differentiable
+    /// operation encountered.
+    typedef int (*Deriv)(double t, const double* sv, const double* fv,
+                         const double* ds, double* df, double* d);
+
+    /// generate C++ source for the system. @return empty string if
+    /// the system contains operations that cannot be compiled (eg data)
+    static std::string source(const EvalTape&, const EvalGodley&,
+                              const std::vector<Integral>&, size_t numStocks);
+
+    /// generate, compile and load the system.
+    /// @return null if the system cannot be compiled natively
+    /// @throw ecolab::error if the compiler fails
+    static std::shared_ptr<JitEquations> compile
+    (const EvalTape&, const EvalGodley&, const std::vector<Integral>&,
+     size_t numStocks);
+
+    /// hash of the generated source, used as the cache key
+    std::size_t hash() const {return m_hash;}
+
+    int rhs(double t, const double* sv, double* result, double* fv) const
+    {return m_rhs(t,sv,result,fv);}
+    int deriv(double t, const double* sv, const double* fv,
+              const double* ds, double* df, double* d) const
+    {return m_deriv(t,sv,fv,ds,df,d);}
+
+    /// opaque handle to a loaded shared object
+    struct Library;
+  private:
+    std::shared_ptr<Library> lib;
+    RHS m_rhs=nullptr;
+    Deriv m_deriv=nullptr;
+    std::size_t m_hash=0;
+  };
+}
+
+#endif
@@ -0,0 +1,198 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "sparseJacobian.h"
+#include <ecolab_epilogue.h>
+
+#include <algorithm>
+#include <functional>
+#include <numeric>
+
+using namespace std;
+
+namespace minsky
+{
+  namespace
+  {
+    void sortUnique(vector<int>& x)
+    {
+      sort(x.begin(), x.end());
+      x.erase(unique(x.begin(), x.end()), x.end());
+    }
+  }
+
+  void SparseJacobian::clear()
+  {
+    rowPtr.clear(); colIdx.clear();
+    colPtr.clear(); cscRow.clear(); cscPos.clear();
+    colour.clear(); colourCols.clear();
+  }
+
+  void SparseJacobian::analyse
+  (const EvalTape& tape, const EvalGodley& godley,
+   const vector<Integral>& integrals, size_t numStocks, size_t numFlows)
+  {
+    clear();
+
+    // stock variables each flow variable depends on. Flow variables
+    // not computed by the tape (eg parameters) depend on nothing.
+    vector<vector<int> > flowDeps(numFlows);
+    auto addDeps=[&](vector<int>& r, int idx, bool flow) {
+      if (idx<0) return;
+      if (flow)
+        r.insert(r.end(), flowDeps[idx].begin(), flowDeps[idx].end());
+      else
+        r.push_back(idx);
+    };
+    std::function<void(size_t,size_t)> analyseRange=[&](size_t begin, size_t end) {
+      for (size_t i=begin; i<end; i=tape.spanEnd(i))
+        {
+          vector<int> d;
+          if (tape.opcode[i]==OperationType::numOps)
+            {
+              // a switch depends on whichever case is selected, but
+              // not on the selector, which is piecewise constant
+              auto& sel=tape.selectOp(i);
+              for (unsigned c=0; c<sel.numCases(); ++c)
+                {
+                  analyseRange(i+1+(c>0? sel.caseEnd[c-1]: 0), i+1+sel.caseEnd[c]);
+                  addDeps(d, tape.out[i], true);
+                }
+            }
+          else
+            {
+              int nArgs=tape.ops[i]->numArgs();
+              if (nArgs>0) addDeps(d, tape.in1[i], tape.flags[i]&EvalTape::flow1);
+              if (nArgs>1) addDeps(d, tape.in2[i], tape.flags[i]&EvalTape::flow2);
+            }
+          sortUnique(d);
+          flowDeps[tape.out[i]].swap(d);
+        }
+    };
+    analyseRange(0, tape.size());
+
+    vector<vector<int> > rows(numStocks);
+    // the Godley block is constant, so its rows come straight from
+    // the table's CSR form
+    for (size_t r=0; r<godley.numRows(); ++r)
+      for (int k=godley.rowStart()[r]; k<godley.rowStart()[r+1]; ++k)
+        addDeps(rows[godley.rowStock()[r]], godley.flowIdx()[k], true);
+    for (auto& i: integrals)
+      if (i.stock.idx()>=0)
+        addDeps(rows[i.stock.idx()], i.input.idx(), i.input.isFlowVar());
+
+    rowPtr.push_back(0);
+    for (auto& r: rows)
+      {
+        sortUnique(r);
+        colIdx.insert(colIdx.end(), r.begin(), r.end());
+        rowPtr.push_back(colIdx.size());
+      }
+
+    // transpose
+    colPtr.assign(numStocks+1, 0);
+    for (int j: colIdx) ++colPtr[j+1];
+    partial_sum(colPtr.begin(), colPtr.end(), colPtr.begin());
+    cscRow.resize(nnz());
+    cscPos.resize(nnz());
+    vector<int> next(colPtr.begin(), colPtr.end()-1);
+    for (size_t i=0; i<numStocks; ++i)
+      for (int k=rowPtr[i]; k<rowPtr[i+1]; ++k)
+        {
+          int p=next[colIdx[k]]++;
+          cscRow[p]=i;
+          cscPos[p]=k;
+        }
+
+    // greedy colouring, densest columns first
+    vector<int> order(numStocks);
+    iota(order.begin(), order.end(), 0);
+    stable_sort(order.begin(), order.end(), [&](int a, int b)
+                {return colPtr[a+1]-colPtr[a] > colPtr[b+1]-colPtr[b];});
+    colour.assign(numStocks, -1);
+    // forbidden[c]==j if colour c is used by a neighbour of column j
+    vector<int> forbidden(numStocks+1, -1);
+    for (int j: order)
+      {
+        for (int p=colPtr[j]; p<colPtr[j+1]; ++p)
+          {
+            int i=cscRow[p];
+            for (int k=rowPtr[i]; k<rowPtr[i+1]; ++k)
+              if (colour[colIdx[k]]>=0)
+                forbidden[colour[colIdx[k]]]=j;
+          }
+        int c=0;
+        while (forbidden[c]==j) ++c;
+        colour[j]=c;
+        if (size_t(c)>=colourCols.size()) colourCols.resize(c+1);
+        colourCols[c].push_back(j);
+      }
+  }
+
+  void SparseJacobian::seed(double ds[], size_t c) const
+  {
+    for (size_t j=0; j<size(); ++j) ds[j]=0;
+    for (int j: colourCols[c]) ds[j]=1;
+  }
+
+  void SparseJacobian::scatter(double values[], size_t c, const double d[]) const
+  {
+    for (int j: colourCols[c])
+      for (int p=colPtr[j]; p<colPtr[j+1]; ++p)
+        values[cscPos[p]]=d[cscRow[p]];
+  }
+
+  vector<int> SparseJacobian::reverseCuthillMcKee() const
+  {
+    int n=size();
+    auto degree=[&](int i) {return rowPtr[i+1]-rowPtr[i]+colPtr[i+1]-colPtr[i];};
+    auto byDegree=[&](int a, int b) {return degree(a)<degree(b);};
+
+    // each connected component is traversed breadth first, from a
+    // vertex of least degree, visiting neighbours in order of degree
+    vector<int> start(n), order, neighbours;
+    iota(start.begin(), start.end(), 0);
+    stable_sort(start.begin(), start.end(), byDegree);
+    vector<bool> visited(n);
+    for (int s: start)
+      {
+        if (visited[s]) continue;
+        size_t head=order.size();
+        order.push_back(s);
+        visited[s]=true;
+        for (; head<order.size(); ++head)
+          {
+            int v=order[head];
+            neighbours.clear();
+            for (int k=rowPtr[v]; k<rowPtr[v+1]; ++k)
+              neighbours.push_back(colIdx[k]);
+            for (int k=colPtr[v]; k<colPtr[v+1]; ++k)
+              neighbours.push_back(cscRow[k]);
+            stable_sort(neighbours.begin(), neighbours.end(), byDegree);
+            for (int w: neighbours)
+              if (!visited[w])
+                {
+                  visited[w]=true;
+                  order.push_back(w);
+                }
+          }
+      }
+    reverse(order.begin(), order.end());
+    return order;
+  }
+}
@@ -0,0 +1,83 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SPARSEJACOBIAN_H
+#define SPARSEJACOBIAN_H
+
+#include "evalTape.h"
+#include "evalGodley.h"
+#include "integral.h"
+#include <vector>
+
+namespace minsky
+{
+  /**
+     Sparsity structure of the Jacobian of the stock variable
+     derivatives with respect to the stock variables, extracted from
+     the operand indices of the evaluation tape, Godley tables and
+     integrals.
+
+     Columns are coloured (Curtis-Powell-Reed) so that columns of the
+     same colour share no nonzero row. All columns of a colour can
+     then be computed with a single directional derivative, seeded
+     with the sum of their unit vectors, so the Jacobian costs
+     numColours() derivative sweeps rather than one per stock.
+  */
+  class SparseJacobian
+  {
+  public:
+    /// @{ compressed sparse row structure: the nonzeros of row \c i
+    /// are in columns colIdx[rowPtr[i]..rowPtr[i+1])
+    std::vector<int> rowPtr, colIdx;
+    /// @}
+    /// @{ the same structure by column: the nonzeros of column \c j
+    /// are in rows cscRow[colPtr[j]..colPtr[j+1]), stored in the CSR
+    /// value array at cscPos[colPtr[j]..colPtr[j+1])
+    std::vector<int> colPtr, cscRow, cscPos;
+    /// @}
+    /// colour of each column
+    std::vector<int> colour;
+    /// columns of each colour
+    std::vector<std::vector<int> > colourCols;
+
+    void analyse(const EvalTape&, const EvalGodley&,
+                 const std::vector<Integral>&, size_t numStocks, size_t numFlows);
+    void clear();
+
+    /// number of rows (and columns)
+    size_t size() const {return rowPtr.empty()? 0: rowPtr.size()-1;}
+    /// number of structural nonzeros
+    size_t nnz() const {return colIdx.size();}
+    size_t numColours() const {return colourCols.size();}
+
+    /// reverse Cuthill-McKee ordering of the stock variables, on the
+    /// symmetrised sparsity structure, which reduces the bandwidth
+    /// of, and the fill in when factorising, the Jacobian.
+    /// @return original indices, in their new order
+    std::vector<int> reverseCuthillMcKee() const;
+
+    /// seed vector \a ds (of size()) for colour \a c
+    void seed(double ds[], size_t c) const;
+    /// store into \a values (CSR order, of size nnz()) the columns of
+    /// colour \a c, given the directional derivative \a d of all
+    /// stock variables for that colour's seed
+    void scatter(double values[], size_t c, const double d[]) const;
+  };
+}
+
+#endif
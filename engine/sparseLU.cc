@@ -0,0 +1,98 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "sparseLU.h"
+#include <ecolab.h>
+#include <ecolab_epilogue.h>
+
+#include <algorithm>
+#include <math.h>
+#include <set>
+
+using namespace std;
+using ecolab::error;
+
+namespace minsky
+{
+  void SparseLU::analyse(const vector<int>& aRowPtr, const vector<int>& aColIdx)
+  {
+    size_t n=aRowPtr.empty()? 0: aRowPtr.size()-1;
+    rowPtr.assign(1,0);
+    colIdx.clear();
+    diag.resize(n);
+    aPos.resize(aColIdx.size());
+    for (size_t i=0; i<n; ++i)
+      {
+        set<int> row(aColIdx.begin()+aRowPtr[i], aColIdx.begin()+aRowPtr[i+1]);
+        if (!row.count(i))
+          throw error("missing diagonal element in row %d",int(i));
+        // eliminating with row k fills in the pattern of U's row k.
+        // Inserted columns exceed k, so are visited by this loop if
+        // below the diagonal.
+        for (auto k=row.begin(); *k<int(i); ++k)
+          row.insert(colIdx.begin()+diag[*k]+1, colIdx.begin()+rowPtr[*k+1]);
+        diag[i]=rowPtr.back()+distance(row.begin(), row.find(i));
+        colIdx.insert(colIdx.end(), row.begin(), row.end());
+        rowPtr.push_back(colIdx.size());
+
+        auto begin=colIdx.begin()+rowPtr[i], end=colIdx.end();
+        for (int p=aRowPtr[i]; p<aRowPtr[i+1]; ++p)
+          aPos[p]=lower_bound(begin, end, aColIdx[p])-colIdx.begin();
+      }
+    lu.resize(colIdx.size());
+    where.assign(n,-1);
+  }
+
+  void SparseLU::factorise(const double a[])
+  {
+    fill(lu.begin(), lu.end(), 0);
+    for (size_t p=0; p<aPos.size(); ++p)
+      lu[aPos[p]]=a[p];
+
+    for (size_t i=0; i<size(); ++i)
+      {
+        for (int p=rowPtr[i]; p<rowPtr[i+1]; ++p)
+          where[colIdx[p]]=p;
+        for (int p=rowPtr[i]; p<diag[i]; ++p)
+          {
+            int k=colIdx[p];
+            double l=lu[p]/=lu[diag[k]];
+            if (l!=0)
+              for (int q=diag[k]+1; q<rowPtr[k+1]; ++q)
+                lu[where[colIdx[q]]]-=l*lu[q];
+          }
+        for (int p=rowPtr[i]; p<rowPtr[i+1]; ++p)
+          where[colIdx[p]]=-1;
+        if (lu[diag[i]]==0 || !isfinite(lu[diag[i]]))
+          throw error("singular matrix at row %d",int(i));
+      }
+  }
+
+  void SparseLU::solve(double b[]) const
+  {
+    for (size_t i=0; i<size(); ++i)
+      for (int p=rowPtr[i]; p<diag[i]; ++p)
+        b[i]-=lu[p]*b[colIdx[p]];
+    for (size_t i=size(); i-->0;)
+      {
+        for (int p=diag[i]+1; p<rowPtr[i+1]; ++p)
+          b[i]-=lu[p]*b[colIdx[p]];
+        b[i]/=lu[diag[i]];
+      }
+  }
+}
@@ -0,0 +1,65 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SPARSELU_H
+#define SPARSELU_H
+
+#include <vector>
+
+namespace minsky
+{
+  /**
+     LU factorisation of a sparse matrix with a fixed nonzero
+     pattern. The fill-in is computed once by analyse(), after which
+     matrices of the same pattern can be repeatedly factorised without
+     further allocation. No pivoting is performed, which is adequate
+     for the diagonally dominated matrices (I-γhJ) arising in implicit
+     integration.
+  */
+  class SparseLU
+  {
+    /// CSR pattern of the combined factors, L (unit diagonal,
+    /// not stored) below the diagonal, U on and above it
+    std::vector<int> rowPtr, colIdx;
+    /// position of the diagonal in each row
+    std::vector<int> diag;
+    /// position in the factors of each entry of the analysed matrix
+    std::vector<int> aPos;
+    std::vector<double> lu;
+    /// workspace mapping column to position within the current row
+    std::vector<int> where;
+  public:
+    /// symbolic analysis of the \c n×n matrix pattern in CSR form,
+    /// with \c n=rowPtr.size()-1. Rows must be sorted, and include
+    /// the diagonal.
+    /// @throw ecolab::error if a diagonal entry is missing
+    void analyse(const std::vector<int>& rowPtr, const std::vector<int>& colIdx);
+    /// numeric factorisation of the matrix with nonzeros \a a, in
+    /// the order of the analysed pattern
+    /// @throw ecolab::error if the matrix is numerically singular
+    void factorise(const double a[]);
+    /// solve LUx=b, overwriting \a b with x
+    void solve(double b[]) const;
+
+    std::size_t size() const {return diag.size();}
+    /// number of nonzeros in the factors, including fill-in
+    std::size_t nnz() const {return colIdx.size();}
+  };
+}
+
+#endif
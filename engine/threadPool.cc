@@ -0,0 +1,101 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "threadPool.h"
+
+namespace minsky
+{
+  ThreadPool::ThreadPool(unsigned nThreads)
+  {
+    if (nThreads==0)
+      nThreads=std::max(1U, std::thread::hardware_concurrency());
+    for (unsigned i=1; i<nThreads; ++i)
+      workers.emplace_back([this]{worker();});
+  }
+
+  ThreadPool::~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      shutdown=true;
+    }
+    start.notify_all();
+    for (auto& w: workers) w.join();
+  }
+
+  void ThreadPool::work()
+  {
+    for (size_t i=next++; i<end; i=next++)
+      try
+        {
+          (*body)(i);
+        }
+      catch (...)
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (!error) error=std::current_exception();
+          next=end; // abandon remaining work
+        }
+  }
+
+  void ThreadPool::worker()
+  {
+    unsigned seen=0;
+    for (;;)
+      {
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          start.wait(lock, [&]{return shutdown || generation!=seen;});
+          if (shutdown) return;
+          seen=generation;
+        }
+        work();
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (--busy==0) done.notify_all();
+        }
+      }
+  }
+
+  void ThreadPool::parallelFor(size_t n, const std::function<void(size_t)>& f)
+  {
+    if (workers.empty() || n<2 || inUse.exchange(true))
+      {
+        for (size_t i=0; i<n; ++i) f(i);
+        return;
+      }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      body=&f;
+      end=n;
+      next=0;
+      error=nullptr;
+      busy=workers.size();
+      ++generation;
+    }
+    start.notify_all();
+    work();
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&]{return busy==0;});
+    body=nullptr;
+    auto e=error;
+    inUse=false;
+    if (e)
+      std::rethrow_exception(e);
+  }
+}
@@ -0,0 +1,80 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace minsky
+{
+  /**
+     A fixed set of worker threads for running data parallel
+     loops. Loop indices are claimed one at a time from a shared
+     atomic counter, so threads that finish their work early
+     automatically take on more of the remaining work.
+  */
+  class ThreadPool
+  {
+  public:
+    /// @param nThreads total number of threads to use, including the
+    /// calling thread. 0 means use the hardware concurrency
+    explicit ThreadPool(unsigned nThreads=0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&)=delete;
+    void operator=(const ThreadPool&)=delete;
+
+    /// number of threads participating in a loop, including the caller
+    unsigned size() const {return workers.size()+1;}
+
+    /// execute \a f(i) for i in [0,n), returning when all are
+    /// complete. The calling thread participates. If any invocation
+    /// throws, remaining indices are abandoned, and the first
+    /// exception is rethrown. If the pool is already running a loop,
+    /// for instance when called concurrently, or from within a loop
+    /// body, \a f is executed serially by the calling thread.
+    void parallelFor(size_t n, const std::function<void(size_t)>& f);
+
+  private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable start, done;
+    /// incremented for each new loop
+    unsigned generation=0;
+    unsigned busy=0;
+    bool shutdown=false;
+    std::atomic<bool> inUse{false};
+
+    // current loop
+    const std::function<void(size_t)>* body=nullptr;
+    size_t end=0;
+    std::atomic<size_t> next{0};
+    std::exception_ptr error;
+
+    void work();
+    void worker();
+  };
+}
+
+#endif
@@ -27,11 +27,9 @@ using namespace ecolab;
 using namespace std;
 namespace minsky
 {
-  std::vector<double> ValueVector::stockVars(1);
-  std::vector<double> ValueVector::flowVars(1);
-
   VariableValue& VariableValue::allocValue()
   {
+    SimulationState& state=minsky();
     switch (m_type)
       {
       case undefined:
@@ -41,14 +39,14 @@ namespace minsky
       case tempFlow:
       case constant:
       case parameter:
-        m_idx=ValueVector::flowVars.size();
-        ValueVector::flowVars.resize(ValueVector::flowVars.size()+1,0);
+        m_idx=state.flowVars.size();
+        state.flowVars.resize(state.flowVars.size()+1,0);
         //      *this=init;
         break;
       case stock:
       case integral:
-        m_idx=ValueVector::stockVars.size();
-        ValueVector::stockVars.resize(ValueVector::stockVars.size()+1);
+        m_idx=state.stockVars.size();
+        state.stockVars.resize(state.stockVars.size()+1);
         //     *this=init;
         break;
       default: break;
@@ -60,18 +58,19 @@ namespace minsky
   {
     if (m_idx==-1)
       allocValue();
+    SimulationState& state=minsky();
     switch (m_type)
       {
       case flow:
       case tempFlow:
       case constant:
       case parameter:
-        assert(size_t(m_idx)<ValueVector::flowVars.size());
-        return ValueVector::flowVars[m_idx];
+        assert(size_t(m_idx)<state.flowVars.size());
+        return state.flowVars[m_idx];
       case stock:
       case integral:
-        assert(size_t(m_idx)<ValueVector::stockVars.size());
-        return ValueVector::stockVars[m_idx];
+        assert(size_t(m_idx)<state.stockVars.size());
+        return state.stockVars[m_idx];
       default: break;
       }
     throw error("invalid access of variable value reference");
@@ -176,8 +175,9 @@ namespace minsky
   void VariableValues::reset()
   {
     // reallocate all variables
-    ValueVector::stockVars.clear();
-    ValueVector::flowVars.clear();
+    SimulationState& state=minsky();
+    state.stockVars.clear();
+    state.flowVars.clear();
     for (auto& v: *this)
       v.second.allocValue().reset(*this);
 }
@@ -37,6 +37,7 @@ namespace minsky
   private:
     Type m_type;
     int m_idx; /// index into value vector
+    /// reference to this variable's value in the current model's SimulationState
     double& valRef(); 
 
 
@@ -77,6 +78,13 @@ namespace minsky
 
     /// allocate space in the variable vector. @returns reference to this
     VariableValue& allocValue();
+    /// relocate the value, given maps \a flowMap and \a stockMap
+    /// from old to new indices into the flow and stock variable
+    /// vectors. Indices outside the maps are left unchanged.
+    void renumber(const std::vector<int>& flowMap, const std::vector<int>& stockMap) {
+      auto& map=isFlowVar()? flowMap: stockMap;
+      if (m_idx>=0 && size_t(m_idx)<map.size()) m_idx=map[m_idx];
+    }
 
     /// evaluates the initial value, based on the set of variables
     /// contained in \a VariableManager. \a visited is used to check
@@ -112,15 +120,18 @@ namespace minsky
     static std::string uqName(const std::string& name);
   };
 
-  struct ValueVector
+  /// numerical state of a simulation. Each model (Minsky object)
+  /// owns one of these, and VariableValues refer into the state of
+  /// the current model (see minsky())
+  struct SimulationState
   {
     /// vector of variables that are integrated via Runge-Kutta. These
     /// variables label the columns of the Godley table
-    static std::vector<double> stockVars;
+    std::vector<double> stockVars=std::vector<double>(1);
     /// variables defined as a simple function of the stock variables,
     /// also known as lhs variables. These variables appear in the body
     /// of the Godley table
-    static std::vector<double> flowVars;
+    std::vector<double> flowVars=std::vector<double>(1);
   };
 
   struct VariableValues: public ConstMap<std::string, VariableValue>
@@ -34,7 +34,7 @@ namespace minsky
 {
   namespace
   {
-    Minsky* l_minsky=NULL;
+    thread_local Minsky* l_minsky=NULL;
   }
 
   Minsky& minsky()
@@ -46,8 +46,8 @@ namespace minsky
       return s_minsky;
   }
 
-  LocalMinsky::LocalMinsky(Minsky& minsky) {l_minsky=&minsky;}
-  LocalMinsky::~LocalMinsky() {l_minsky=NULL;}
+  LocalMinsky::LocalMinsky(Minsky& minsky): prev(l_minsky) {l_minsky=&minsky;}
+  LocalMinsky::~LocalMinsky() {l_minsky=prev;}
 
   cmd_data* getCommandData(const string& name)
   {
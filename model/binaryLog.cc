@@ -0,0 +1,157 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "binaryLog.h"
+#include <ecolab.h>
+#include <ecolab_epilogue.h>
+
+#include <algorithm>
+#include <chrono>
+#include <stdint.h>
+
+using namespace std;
+using ecolab::error;
+
+namespace minsky
+{
+  namespace
+  {
+    const char magic[]="MKYLOG01";
+    /// number of rows written per chunk
+    const size_t chunkRows=1024;
+
+    void writeSize(ostream& o, uint64_t x)
+    {o.write(reinterpret_cast<const char*>(&x), sizeof(x));}
+
+    uint64_t readSize(istream& i)
+    {
+      uint64_t x=0;
+      i.read(reinterpret_cast<char*>(&x), sizeof(x));
+      return x;
+    }
+  }
+
+  BinaryLog::BinaryLog(const string& fileName, const vector<string>& columns,
+                       size_t bufferBytes):
+    fileName(fileName), file(fileName, ios::binary), width(columns.size()),
+    capacity(max(bufferBytes/(max(width, size_t(1))*sizeof(double)), size_t(2))),
+    ring(width*capacity)
+  {
+    if (!file)
+      throw error("unable to open %s",fileName.c_str());
+    file.write(magic, 8);
+    writeSize(file, width);
+    for (auto& c: columns)
+      {
+        writeSize(file, c.size());
+        file.write(c.data(), c.size());
+      }
+    writer=thread([this]{write();});
+  }
+
+  BinaryLog::~BinaryLog() {join();}
+
+  void BinaryLog::join()
+  {
+    if (writer.joinable())
+      {
+        done.store(true, memory_order_release);
+        writer.join();
+      }
+  }
+
+  void BinaryLog::close()
+  {
+    join();
+    if (failed)
+      throw error("unable to write %s, which is incomplete",fileName.c_str());
+  }
+
+  double* BinaryLog::beginRow()
+  {
+    size_t h=head.load(memory_order_relaxed);
+    while (h-tail.load(memory_order_acquire)>=capacity)
+      this_thread::yield();
+    return &ring[(h%capacity)*width];
+  }
+
+  void BinaryLog::write()
+  {
+    vector<double> chunk;
+    for (;;)
+      {
+        size_t t=tail.load(memory_order_relaxed), h=head.load(memory_order_acquire);
+        if (h==t)
+          {
+            // rows committed before done was set have been seen by
+            // the above load of head
+            if (done.load(memory_order_acquire) && head.load(memory_order_acquire)==t)
+              break;
+            this_thread::sleep_for(chrono::milliseconds(1));
+            continue;
+          }
+        size_t n=min(h-t, chunkRows);
+        // transpose into columns
+        chunk.resize(n*width);
+        for (size_t r=0; r<n; ++r)
+          {
+            const double* row=&ring[((t+r)%capacity)*width];
+            for (size_t c=0; c<width; ++c)
+              chunk[c*n+r]=row[c];
+          }
+        tail.store(t+n, memory_order_release);
+        // after a failure, rows are still consumed, so that the
+        // producer is not blocked, and the failure is reported on close
+        writeSize(file, n);
+        file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size()*sizeof(double));
+      }
+    file.close();
+    failed=!file;
+  }
+
+  void convertBinaryLog(const string& binary, const string& text)
+  {
+    ifstream in(binary, ios::binary);
+    char m[8];
+    if (!in.read(m, 8) || !equal(m, m+8, magic))
+      throw error("%s is not a Minsky binary log",binary.c_str());
+    size_t width=readSize(in);
+    ofstream out(text);
+    for (size_t c=0; c<width && in; ++c)
+      {
+        string name(readSize(in), '\0');
+        in.read(&name[0], name.size());
+        out<<(c? " ": "#")<<name;
+      }
+    out<<'\n';
+
+    vector<double> chunk;
+    for (size_t n=readSize(in); in; n=readSize(in))
+      {
+        chunk.resize(n*width);
+        if (!in.read(reinterpret_cast<char*>(chunk.data()), chunk.size()*sizeof(double)))
+          throw error("%s is truncated",binary.c_str());
+        for (size_t r=0; r<n; ++r)
+          {
+            for (size_t c=0; c<width; ++c)
+              out<<(c? " ": "")<<chunk[c*n+r];
+            out<<'\n';
+          }
+      }
+  }
+}
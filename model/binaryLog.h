@@ -0,0 +1,93 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef BINARYLOG_H
+#define BINARYLOG_H
+
+#include <atomic>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace minsky
+{
+  /**
+     Simulation log in a binary columnar format, written to file by a
+     background thread, so that logging does not hold up the
+     simulation.
+
+     Rows are appended by a single producer thread into a lock-free
+     ring buffer, from which the writer thread takes them in chunks.
+     The producer only waits if the ring is full. The ring is sized
+     in bytes rather than rows, as models may log tens of thousands
+     of columns.
+
+     The file consists of the 8 byte magic string "MKYLOG01", the
+     number of columns as a uint64, then each column name as a uint64
+     length followed by its characters. The rows follow in chunks,
+     each being the number of rows n as a uint64, then n float64
+     values of the first column, n of the second, and so on. Numbers
+     are in the native byte order.
+  */
+  class BinaryLog
+  {
+  public:
+    /// @param bufferBytes size of the ring buffer, which holds at
+    /// least 2 rows whatever the number of columns
+    /// @throw ecolab::error if \a fileName cannot be opened
+    BinaryLog(const std::string& fileName, const std::vector<std::string>& columns,
+              size_t bufferBytes=size_t(16)<<20);
+    /// writes out any outstanding rows, and closes the file
+    ~BinaryLog();
+    /// as the destructor, but reports failure
+    /// @throw ecolab::error if any of the log could not be written
+    void close();
+    BinaryLog(const BinaryLog&)=delete;
+    void operator=(const BinaryLog&)=delete;
+
+    size_t numColumns() const {return width;}
+
+    /// space for the next row, of numColumns() values, to be filled
+    /// in before calling commitRow()
+    double* beginRow();
+    /// make the row returned by beginRow available to the writer
+    void commitRow() {head.store(head.load(std::memory_order_relaxed)+1, std::memory_order_release);}
+
+  private:
+    std::string fileName;
+    std::ofstream file;
+    size_t width, capacity;
+    /// set by the writer thread if the file could not be written
+    bool failed=false;
+    std::vector<double> ring;
+    /// number of rows produced, and consumed
+    std::atomic<size_t> head{0}, tail{0};
+    std::atomic<bool> done{false};
+    std::thread writer;
+    void write();
+    void join();
+  };
+
+  /// convert a BinaryLog file \a binary into the text format written
+  /// by Minsky::openLogFile, as file \a text
+  /// @throw ecolab::error if \a binary is not a valid log
+  void convertBinaryLog(const std::string& binary, const std::string& text);
+}
+
+#endif
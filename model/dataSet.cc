@@ -0,0 +1,376 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "dataSet.h"
+#include <ecolab.h>
+#include <ecolab_epilogue.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <map>
+#include <mutex>
+#include <numeric>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using ecolab::error;
+
+namespace minsky
+{
+  namespace
+  {
+    const char cacheMagic[]="MKYDSET2";
+
+    /// modification time of \a s in nanoseconds, so that files
+    /// rewritten within the same second are told apart
+    int64_t modificationTime(const struct stat& s)
+    {
+#if defined(__APPLE__)
+      return int64_t(s.st_mtimespec.tv_sec)*1000000000+s.st_mtimespec.tv_nsec;
+#elif defined(_WIN32)
+      return int64_t(s.st_mtime)*1000000000;
+#else
+      return int64_t(s.st_mtim.tv_sec)*1000000000+s.st_mtim.tv_nsec;
+#endif
+    }
+
+    /// read only view of a file's contents
+    class MappedFile
+    {
+      const char* data=nullptr;
+      size_t size=0;
+#ifdef _WIN32
+      string buffer;
+#endif
+      MappedFile(const MappedFile&)=delete;
+      void operator=(const MappedFile&)=delete;
+    public:
+      explicit MappedFile(const string& fileName)
+      {
+#ifdef _WIN32
+        ifstream f(fileName, ios::binary);
+        if (!f) throw error("unable to open %s",fileName.c_str());
+        buffer.assign(istreambuf_iterator<char>(f), istreambuf_iterator<char>());
+        data=buffer.data();
+        size=buffer.size();
+#else
+        int fd=open(fileName.c_str(), O_RDONLY);
+        struct stat s;
+        if (fd<0 || fstat(fd, &s)!=0)
+          {
+            if (fd>=0) close(fd);
+            throw error("unable to open %s",fileName.c_str());
+          }
+        size=s.st_size;
+        if (size)
+          {
+            void* p=mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p==MAP_FAILED)
+              {
+                close(fd);
+                throw error("unable to map %s",fileName.c_str());
+              }
+            madvise(p, size, MADV_SEQUENTIAL);
+            data=static_cast<const char*>(p);
+          }
+        close(fd);
+#endif
+      }
+      ~MappedFile()
+      {
+#ifndef _WIN32
+        if (data) munmap(const_cast<char*>(data), size);
+#endif
+      }
+      const char* begin() const {return data;}
+      const char* end() const {return data+size;}
+    };
+
+    bool isBlank(char c) {return c==' ' || c=='\t' || c=='\r';}
+
+    /// splits lines into fields, either at a delimiter character, or
+    /// at runs of whitespace if the delimiter is 0. Lines are
+    /// terminated by a character that is neither blank, a delimiter
+    /// nor part of a number, so that strtod stops there.
+    struct FieldSplitter
+    {
+      char delim=0;
+      const char* p;
+      const char* e;
+
+      void line(const char* b, const char* eol)
+      {
+        p=b; e=eol;
+        while (e>p && isBlank(e[-1])) --e;
+      }
+      bool more() const {return p<e;}
+
+      /// returns the next field as [b,q), advancing past it
+      void next(const char*& b, const char*& q)
+      {
+        while (p<e && isBlank(*p) && *p!=delim) ++p;
+        b=p;
+        if (delim)
+          {
+            auto d=static_cast<const char*>(memchr(p, delim, e-p));
+            q=d? d: e;
+            p=d? d+1: e;
+          }
+        else
+          {
+            while (p<e && !isBlank(*p)) ++p;
+            q=p;
+          }
+        while (q>b && isBlank(q[-1])) --q;
+      }
+
+      /// the next field as a number, NaN if it is not one
+      double number()
+      {
+        const char *b, *q;
+        next(b,q);
+        if (q-b>=2 && *b=='"' && q[-1]=='"')
+          {++b; --q;}
+        // strtod skips leading newlines, so must not see an empty field
+        if (b==q) return numeric_limits<double>::quiet_NaN();
+        char* end;
+        double r=strtod(b, &end);
+        return end==q? r: numeric_limits<double>::quiet_NaN();
+      }
+    };
+
+    template <class T> void write(ostream& o, const T& x)
+    {o.write(reinterpret_cast<const char*>(&x), sizeof(x));}
+    template <class T> bool read(istream& i, T& x)
+    {return bool(i.read(reinterpret_cast<char*>(&x), sizeof(x)));}
+  }
+
+  void DataSet::parse(const char* begin, const char* end)
+  {
+    names.clear();
+    x.reset();
+    y.clear();
+    vector<vector<double> > columns;
+    FieldSplitter fields;
+    vector<double> row;
+    string lastLine;
+
+    auto parseLine=[&](const char* b, const char* eol) {
+      while (b<eol && isBlank(*b)) ++b;
+      if (b==eol || *b=='#') return;
+      fields.line(b, eol);
+      if (columns.empty())
+        {
+          // first line: sniff the delimiter, and check for headings
+          for (char d: {'\t', ';', ','})
+            if (memchr(b, d, fields.e-b))
+              {
+                fields.delim=d;
+                break;
+              }
+          vector<string> headings;
+          for (FieldSplitter f=fields; f.more();)
+            {
+              const char *hb, *hq;
+              f.next(hb, hq);
+              if (hq-hb>=2 && *hb=='"' && hq[-1]=='"')
+                {++hb; --hq;}
+              headings.emplace_back(hb, hq);
+            }
+          columns.resize(headings.size());
+          if (isnan(FieldSplitter(fields).number()))
+            {
+              names=headings;
+              return;
+            }
+          names.push_back("x");
+          for (size_t i=1; i<headings.size(); ++i)
+            names.push_back("y"+to_string(i));
+        }
+      row.clear();
+      for (size_t i=0; i<columns.size(); ++i)
+        row.push_back(fields.number());
+      if (!isnan(row[0]))
+        for (size_t i=0; i<columns.size(); ++i)
+          columns[i].push_back(row[i]);
+    };
+
+    for (const char* p=begin; p<end;)
+      {
+        auto eol=static_cast<const char*>(memchr(p, '\n', end-p));
+        if (!eol)
+          {
+            // an unterminated last line is copied, to terminate it
+            lastLine.assign(p, end);
+            parseLine(lastLine.c_str(), lastLine.c_str()+lastLine.size());
+            break;
+          }
+        parseLine(p, eol);
+        p=eol+1;
+      }
+
+    if (columns.empty())
+      {
+        x=make_shared<vector<double> >();
+        return;
+      }
+
+    // sort by x, keeping the last of equal values
+    auto& xs=columns[0];
+    size_t n=xs.size();
+    bool sorted=true;
+    for (size_t i=1; sorted && i<n; ++i)
+      sorted=xs[i-1]<xs[i];
+    if (!sorted)
+      {
+        vector<size_t> order(n);
+        iota(order.begin(), order.end(), 0);
+        stable_sort(order.begin(), order.end(),
+                    [&](size_t i, size_t j) {return xs[i]<xs[j];});
+        size_t m=0;
+        for (size_t i=0; i<n; ++i)
+          if (i+1==n || xs[order[i]]<xs[order[i+1]])
+            order[m++]=order[i];
+        order.resize(m);
+        for (auto& c: columns)
+          {
+            vector<double> s;
+            s.reserve(m);
+            for (auto i: order)
+              s.push_back(c[i]);
+            c.swap(s);
+          }
+      }
+
+    x=make_shared<vector<double> >(move(columns[0]));
+    for (size_t i=1; i<columns.size(); ++i)
+      y.push_back(make_shared<vector<double> >(move(columns[i])));
+  }
+
+  bool DataSet::readCache(const string& fileName)
+  {
+    ifstream f(fileName+".mkycache", ios::binary);
+    // sizes read are checked against what remains of the file before
+    // anything is allocated, so a corrupt cache is simply rejected
+    f.seekg(0, ios::end);
+    uint64_t remaining=max(streamoff(f.tellg()), streamoff(0));
+    f.seekg(0);
+    char magic[8];
+    uint64_t size, numColumns, numRows;
+    int64_t time;
+    if (!f.read(magic, 8) || memcmp(magic, cacheMagic, 8)!=0 ||
+        !read(f, size) || !read(f, time) || size!=sourceSize || time!=sourceTime ||
+        !read(f, numColumns) || !read(f, numRows) || numColumns==0 || numRows==0)
+      return false;
+    remaining-=min(remaining, uint64_t(8+4*sizeof(uint64_t)));
+    // each column has a name length, and numRows values
+    if (numColumns>remaining/sizeof(uint64_t) ||
+        numRows+1>remaining/sizeof(double)/numColumns)
+      return false;
+    remaining-=numColumns*(numRows+1)*sizeof(double);
+    names.resize(numColumns);
+    for (auto& name: names)
+      {
+        uint64_t len;
+        if (!read(f, len) || len>remaining) return false;
+        remaining-=len;
+        name.resize(len);
+        if (!f.read(&name[0], len)) return false;
+      }
+    vector<Column> columns;
+    for (uint64_t i=0; i<numColumns; ++i)
+      {
+        auto c=make_shared<vector<double> >(numRows);
+        if (!f.read(reinterpret_cast<char*>(c->data()), numRows*sizeof(double)))
+          return false;
+        columns.push_back(c);
+      }
+    x=columns[0];
+    y.assign(columns.begin()+1, columns.end());
+    return true;
+  }
+
+  void DataSet::writeCache(const string& fileName) const
+  {
+    // the cache is only an optimisation, so failure to write it is
+    // not an error. Write to a temporary, so that readers never see
+    // a partial file
+    string cacheName=fileName+".mkycache", tmpName=cacheName+".tmp";
+    {
+      ofstream f(tmpName, ios::binary);
+      f.write(cacheMagic, 8);
+      write(f, sourceSize);
+      write(f, sourceTime);
+      write(f, uint64_t(y.size()+1));
+      write(f, uint64_t(x->size()));
+      for (auto& name: names)
+        {
+          write(f, uint64_t(name.size()));
+          f.write(name.data(), name.size());
+        }
+      f.write(reinterpret_cast<const char*>(x->data()), x->size()*sizeof(double));
+      for (auto& c: y)
+        f.write(reinterpret_cast<const char*>(c->data()), c->size()*sizeof(double));
+      if (f) f.close();
+      if (!f)
+        {
+          remove(tmpName.c_str());
+          return;
+        }
+    }
+    remove(cacheName.c_str()); // rename does not replace on Windows
+    rename(tmpName.c_str(), cacheName.c_str());
+  }
+
+  shared_ptr<const DataSet> DataSet::load(const string& fileName, bool cache)
+  {
+    struct stat s;
+    if (stat(fileName.c_str(), &s)!=0)
+      throw error("unable to open %s",fileName.c_str());
+
+    static mutex registryMutex;
+    static map<string, weak_ptr<const DataSet> > registry;
+    lock_guard<mutex> lock(registryMutex);
+    auto& entry=registry[fileName];
+    auto r=entry.lock();
+    if (r && r->sourceSize==uint64_t(s.st_size) && r->sourceTime==modificationTime(s))
+      return r;
+
+    auto d=make_shared<DataSet>();
+    d->sourceSize=s.st_size;
+    d->sourceTime=modificationTime(s);
+    if (!cache || !d->readCache(fileName))
+      {
+        MappedFile f(fileName);
+        d->parse(f.begin(), f.end());
+        // an empty set is as quick to parse as to read back
+        if (cache && !d->x->empty()) d->writeCache(fileName);
+      }
+    entry=d;
+    return d;
+  }
+}
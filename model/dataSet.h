@@ -0,0 +1,72 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace minsky
+{
+  /**
+     Numerical table read from a delimited text file, for DataOp. The
+     first column is the independent variable, and each further
+     column a series defined on it.
+
+     Lines starting with '#', and blank lines, are ignored. The
+     delimiter is taken to be the first of tab, ';' or ',' appearing
+     in the first line, otherwise columns are separated by runs of
+     whitespace. If the first line does not start with a number, it
+     is taken as the column headings. Rows are sorted by the first
+     column; where it is repeated, the last row wins. Rows without a
+     number in the first column are dropped, and missing or
+     non-numeric values in the others become NaN.
+
+     Columns are shared, immutable, so the data operations reading a
+     file can all refer to the same copy.
+  */
+  struct DataSet
+  {
+    /// column headings, "x", "y1", "y2"... if the file has none
+    std::vector<std::string> names;
+    typedef std::shared_ptr<const std::vector<double> > Column;
+    Column x;
+    std::vector<Column> y;
+
+    /// parse the text in [\a begin, \a end)
+    void parse(const char* begin, const char* end);
+
+    /// returns the data in \a fileName, shared with other callers
+    /// while the file is unmodified. If \a cache, a binary copy is
+    /// kept alongside, in \a fileName.mkycache, and read instead of
+    /// \a fileName if its size and modification time are unchanged.
+    static std::shared_ptr<const DataSet> load(const std::string& fileName, bool cache=false);
+
+    /// size and modification time, in nanoseconds, of the file read
+    uint64_t sourceSize=0;
+    int64_t sourceTime=0;
+  private:
+    bool readCache(const std::string& fileName);
+    void writeCache(const std::string& fileName) const;
+  };
+}
+
+#endif
@@ -0,0 +1,106 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "ensemble.h"
+#include "minsky.h"
+#include <ecolab_epilogue.h>
+
+using namespace std;
+
+namespace minsky
+{
+  template <size_t N>
+  Ensemble<N>::Ensemble(const Minsky& minsky):
+    minsky(minsky), k1(N*minsky.stockVars.size()), k2(k1.size()),
+    k3(k1.size()), k4(k1.size()), tmp(k1.size()),
+    stockVars(k1.size()), flowVars(N*minsky.flowVars.size())
+  {
+    for (size_t i=0; i<minsky.stockVars.size(); ++i)
+      for (size_t l=0; l<N; ++l)
+        stockVars[N*i+l]=minsky.stockVars[i];
+    for (size_t i=0; i<minsky.flowVars.size(); ++i)
+      for (size_t l=0; l<N; ++l)
+        flowVars[N*i+l]=minsky.flowVars[i];
+  }
+
+  template <size_t N>
+  void Ensemble<N>::evalRHS(double result[], double t, const double sv[], double fv[]) const
+  {
+    minsky.rhsTape.evalLanes<N>(fv, sv, t);
+
+    for (size_t i=0; i<stockVars.size(); ++i) result[i]=0;
+    minsky.evalGodley.evalLanes<N>(result, fv);
+    for (auto& i: minsky.integrals)
+      {
+        if (i.input.idx()<0)
+          throw error("integral not wired");
+        double* r=result+N*i.stock.idx();
+        const double* x=(i.input.isFlowVar()? fv: sv)+N*i.input.idx();
+        for (size_t l=0; l<N; ++l)
+          r[l]=x[l];
+      }
+  }
+
+  template <size_t N>
+  void Ensemble<N>::evalFlows()
+  {
+    minsky.tape.evalLanes<N>(flowVars.data(), stockVars.data(), t);
+  }
+
+  template <size_t N>
+  void Ensemble<N>::eulerStep(double h)
+  {
+    evalRHS(k1.data(), t, stockVars.data(), flowVars.data());
+    for (size_t i=0; i<stockVars.size(); ++i)
+      stockVars[i]+=h*k1[i];
+    t+=h;
+  }
+
+  template <size_t N>
+  void Ensemble<N>::rk4Step(double h)
+  {
+    const size_t n=stockVars.size();
+    double* fv=flowVars.data();
+    evalRHS(k1.data(), t, stockVars.data(), fv);
+    for (size_t i=0; i<n; ++i) tmp[i]=stockVars[i]+0.5*h*k1[i];
+    evalRHS(k2.data(), t+0.5*h, tmp.data(), fv);
+    for (size_t i=0; i<n; ++i) tmp[i]=stockVars[i]+0.5*h*k2[i];
+    evalRHS(k3.data(), t+0.5*h, tmp.data(), fv);
+    for (size_t i=0; i<n; ++i) tmp[i]=stockVars[i]+h*k3[i];
+    evalRHS(k4.data(), t+h, tmp.data(), fv);
+    for (size_t i=0; i<n; ++i)
+      stockVars[i]+=h*(k1[i]+2*k2[i]+2*k3[i]+k4[i])/6;
+    t+=h;
+  }
+
+  template <size_t N>
+  void Ensemble<N>::evolve(double t1, double h, bool rk4)
+  {
+    if (h<=0) throw error("step size must be positive");
+    while (t<t1)
+      {
+        double dt=min(h, t1-t);
+        double target = dt<t1-t? t+dt: t1;
+        if (rk4) rk4Step(dt); else eulerStep(dt);
+        t=target; // avoid accumulating rounding error at the endpoint
+      }
+  }
+
+  template class Ensemble<4>;
+  template class Ensemble<8>;
+}
@@ -0,0 +1,76 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <stddef.h>
+#include <vector>
+
+namespace minsky
+{
+  class Minsky;
+
+  /**
+     \a N simulations of the same model, integrated in lock step with
+     a fixed step size. Variables are stored [variable][lane], so the
+     value of variable \c i in lane \c l is at \c N*i+l, and each
+     instruction of the model's equations is applied to \a N
+     contiguous values at once (see EvalTape::evalLanes). Lanes only
+     differ in their initial values of stock and flow variables,
+     which can be used to vary parameters and initial conditions.
+     Instantiated for N=4 and 8.
+  */
+  template <size_t N>
+  class Ensemble
+  {
+    const Minsky& minsky;
+    /// Runge-Kutta stages and workspace
+    std::vector<double> k1, k2, k3, k4, tmp;
+  public:
+    static const size_t lanes=N;
+    std::vector<double> stockVars, flowVars;
+    double t=0;
+
+    /// initialise all lanes to the current state of \a minsky, which
+    /// must have had its equations constructed
+    Ensemble(const Minsky& minsky);
+
+    /// @{ value of variable \a idx in lane \a lane
+    double& stock(int idx, size_t lane) {return stockVars[N*idx+lane];}
+    double& flow(int idx, size_t lane) {return flowVars[N*idx+lane];}
+    /// @}
+
+    /// compute the time derivative of stock variables \a sv in \a
+    /// result, updating flow variables \a fv
+    /// @throw ecolab::error if a non-finite value is produced in any lane
+    void evalRHS(double result[], double t, const double sv[], double fv[]) const;
+    /// update flowVars from the current stock variables
+    void evalFlows();
+
+    /// @{ advance all lanes by a single step of size \a h
+    void eulerStep(double h);
+    void rk4Step(double h);
+    /// @}
+    /// advance all lanes to exactly \a t1, in steps no bigger than
+    /// \a h, using RK4 if \a rk4 is true, otherwise explicit Euler
+    void evolve(double t1, double h, bool rk4);
+  };
+}
+
+#endif
@@ -0,0 +1,223 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "explicitRK.h"
+#include "minsky.h"
+#include <ecolab_epilogue.h>
+
+#include <algorithm>
+#include <math.h>
+
+using namespace std;
+
+namespace minsky
+{
+  /// embedded pair, whose last stage is evaluated at the solution
+  struct ExplicitRK::Tableau
+  {
+    /// order of the local error estimate
+    unsigned order;
+    vector<double> c;
+    /// coefficients a[j][l], l<j, of stage j. The last row is the
+    /// weights of the solution.
+    vector<vector<double> > a;
+    /// weights of the error estimate
+    vector<double> e;
+  };
+
+  namespace
+  {
+    // Dormand & Prince, J Comp Appl Math 6 19 (1980)
+    const ExplicitRK::Tableau dormandPrince
+    {5, {0, 1.0/5, 3.0/10, 4.0/5, 8.0/9, 1, 1},
+        {{},
+         {1.0/5},
+         {3.0/40, 9.0/40},
+         {44.0/45, -56.0/15, 32.0/9},
+         {19372.0/6561, -25360.0/2187, 64448.0/6561, -212.0/729},
+         {9017.0/3168, -355.0/33, 46732.0/5247, 49.0/176, -5103.0/18656},
+         {35.0/384, 0, 500.0/1113, 125.0/192, -2187.0/6784, 11.0/84}},
+        {71.0/57600, 0, -71.0/16695, 71.0/1920, -17253.0/339200, 22.0/525, -1.0/40}};
+
+    // Bogacki & Shampine, Appl Math Lett 2 321 (1989)
+    const ExplicitRK::Tableau bogackiShampine
+    {3, {0, 1.0/2, 3.0/4, 1},
+        {{},
+         {1.0/2},
+         {0, 3.0/4},
+         {2.0/9, 1.0/3, 4.0/9}},
+        {-5.0/72, 1.0/12, 1.0/9, -1.0/8}};
+
+    // Prince & Dormand, J Comp Appl Math 7 67 (1981), RK8(7)13M,
+    // with the solution appended as a fourteenth stage, for FSAL
+    const ExplicitRK::Tableau princeDormand8
+    {8, {0, 1.0/18, 1.0/12, 1.0/8, 5.0/16, 3.0/8, 59.0/400, 93.0/200,
+         5490023248.0/9719169821, 13.0/20, 1201146811.0/1299019798, 1, 1, 1},
+        {{},
+         {1.0/18},
+         {1.0/48, 1.0/16},
+         {1.0/32, 0, 3.0/32},
+         {5.0/16, 0, -75.0/64, 75.0/64},
+         {3.0/80, 0, 0, 3.0/16, 3.0/20},
+         {29443841.0/614563906, 0, 0, 77736538.0/692538347, -28693883.0/1125000000,
+          23124283.0/1800000000},
+         {16016141.0/946692911, 0, 0, 61564180.0/158732637, 22789713.0/633445777,
+          545815736.0/2771057229, -180193667.0/1043307555},
+         {39632708.0/573591083, 0, 0, -433636366.0/683701615, -421739975.0/2616292301,
+          100302831.0/723423059, 790204164.0/839813087, 800635310.0/3783071287},
+         {246121993.0/1340847787, 0, 0, -37695042795.0/15268766246,
+          -309121744.0/1061227803, -12992083.0/490766935, 6005943493.0/2108947869,
+          393006217.0/1396673457, 123872331.0/1001029789},
+         {-1028468189.0/846180014, 0, 0, 8478235783.0/508512852,
+          1311729495.0/1432422823, -10304129995.0/1701304382, -48777925059.0/3047939560,
+          15336726248.0/1032824649, -45442868181.0/3398467696, 3065993473.0/597172653},
+         {185892177.0/718116043, 0, 0, -3185094517.0/667107341, -477755414.0/1098053517,
+          -703635378.0/230739211, 5731566787.0/1027545527, 5232866602.0/850066563,
+          -4093664535.0/808688257, 3962137247.0/1805957418, 65686358.0/487910083},
+         {403863854.0/491063109, 0, 0, -5068492393.0/434740067, -411421997.0/543043805,
+          652783627.0/914296604, 11173962825.0/925320556, -13158990841.0/6184727034,
+          3936647629.0/1978049680, -160528059.0/685178525, 248638103.0/1413531060, 0},
+         {14005451.0/335480064, 0, 0, 0, 0, -59238493.0/1068277825,
+          181606767.0/758867731, 561292985.0/797845732, -1041891430.0/1371343529,
+          760417239.0/1151165299, 118820643.0/751138087, -528747749.0/2220607170, 1.0/4}},
+        {14005451.0/335480064-13451932.0/455176623, 0, 0, 0, 0,
+         -59238493.0/1068277825+808719846.0/976000145,
+         181606767.0/758867731-1757004468.0/5645159321,
+         561292985.0/797845732-656045339.0/265891186,
+         -1041891430.0/1371343529+3867574721.0/1518517206,
+         760417239.0/1151165299-465885868.0/322736535,
+         118820643.0/751138087-53011238.0/667516719, -528747749.0/2220607170-2.0/45,
+         1.0/4, 0}};
+
+    const ExplicitRK::Tableau* tableauFor(int order)
+    {
+      switch (order)
+        {
+        case 1: case 2: return &bogackiShampine;
+        case 4: return &dormandPrince;
+        case 8: return &princeDormand8;
+        default:
+          throw error("order %d solver not supported",order);
+        }
+    }
+  }
+
+  ExplicitRK::ExplicitRK(const Minsky& minsky, const vector<double>& flowInit):
+    minsky(minsky), flowInit(flowInit), tableau(*tableauFor(minsky.order)),
+    h(minsky.stepMax)
+  {
+    if (h<=0)
+      throw error("maximum step size must be positive");
+    size_t n=minsky.stockVars.size();
+    flow.resize(flowInit.size());
+    k.resize(tableau.c.size(), vector<double>(n));
+    for (auto v: {&y1, &yStart, &fStart, &yEnd, &fEnd})
+      v->resize(n);
+  }
+
+  void ExplicitRK::rhs(double result[], double t, const double sv[])
+  {
+    flow=flowInit;
+    minsky.evalRHS(result, t, sv, &flow[0]);
+    ++numRHS;
+  }
+
+  void ExplicitRK::evolve(double& t, double t1, double sv[], unsigned maxSteps)
+  {
+    const size_t n=y1.size(), s=k.size();
+    const double hmin=minsky.stepMin, hmax=minsky.stepMax;
+    // PI controller exponents, per Hairer & Wanner, Solving Ordinary
+    // Differential Equations II, §IV.2
+    const double beta=0.2/tableau.order, alpha=1.0/tableau.order-0.75*beta;
+    fsal=false; // sv may have been modified since the last call
+    for (unsigned steps=0; t<t1 && (maxSteps==0 || steps<maxSteps);)
+      {
+        double hs=min(h, t1-t);
+        bool last = hs>=t1-t;
+        if (!fsal)
+          {
+            rhs(&k[0][0], t, sv);
+            fsal=true; // and remains valid if this step is rejected
+          }
+        // the last stage is evaluated at the solution, leaving it in y1
+        for (size_t j=1; j<s; ++j)
+          {
+            auto& a=tableau.a[j];
+            for (size_t i=0; i<n; ++i)
+              {
+                double y=sv[i];
+                for (size_t l=0; l<j; ++l)
+                  y+=hs*a[l]*k[l][i];
+                y1[i]=y;
+              }
+            rhs(&k[j][0], t+tableau.c[j]*hs, &y1[0]);
+          }
+
+        double err=0;
+        for (size_t i=0; i<n; ++i)
+          {
+            double e=0;
+            for (size_t j=0; j<s; ++j)
+              e+=tableau.e[j]*k[j][i];
+            e*=hs/(minsky.epsAbs+minsky.epsRel*max(fabs(sv[i]),fabs(y1[i])));
+            err+=e*e;
+          }
+        err=sqrt(err/n);
+
+        if (err<=1 || (hs<=hmin && isfinite(err)))
+          {
+            tStart=t;
+            copy(sv, sv+n, yStart.begin());
+            fStart.swap(k[0]);
+            copy(y1.begin(), y1.end(), sv);
+            yEnd=y1;
+            fEnd=k[s-1];
+            k[0]=k[s-1];
+            fsal=true;
+            t = last? t1: t+hs;
+            tEnd=t;
+            haveStep=true;
+            ++steps; ++numSteps;
+            // a step truncated at the end point says nothing about h
+            if (last && hs<h) continue;
+            double fac = err>0? 0.9*pow(err,-alpha)*pow(errPrev,beta): 10;
+            h=min(hmax, max(hmin, hs*min(10.0, max(0.2, fac))));
+            errPrev=max(err, 1e-4);
+          }
+        else
+          {
+            ++numRejected;
+            if (hs<=hmin)
+              throw error("step failed at minimum step size at t=%g",t);
+            h=max(hmin, hs*(isfinite(err)? max(0.2, 0.9*pow(err,-alpha)): 0.2));
+            if (h<1e-12*max(1.0,fabs(t)))
+              throw error("step size underflow at t=%g",t);
+          }
+      }
+  }
+
+  bool ExplicitRK::interpolate(double t, double sv[]) const
+  {
+    if (!haveStep || t<tStart || t>tEnd) return false;
+    double dt=tEnd-tStart, s=dt>0? (t-tStart)/dt: 1, s2=s*s, s3=s2*s;
+    double h00=2*s3-3*s2+1, h10=(s3-2*s2+s)*dt, h01=3*s2-2*s3, h11=(s3-s2)*dt;
+    for (size_t i=0; i<yStart.size(); ++i)
+      sv[i]=h00*yStart[i]+h10*fStart[i]+h01*yEnd[i]+h11*fEnd[i];
+    return true;
+  }
+}
@@ -0,0 +1,82 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef EXPLICITRK_H
+#define EXPLICITRK_H
+
+#include "odeSolver.h"
+#include <vector>
+
+namespace minsky
+{
+  /**
+     Native explicit embedded Runge-Kutta solver, avoiding the
+     overheads of the GSL driver. Order 4 selects the Dormand-Prince
+     5(4) pair, orders 1 and 2 the Bogacki-Shampine 3(2) pair, and
+     order 8 the Prince-Dormand 8(7) pair, for high accuracy runs. In
+     all of them, the last stage evaluates the derivative at the
+     solution, so it serves as the first stage of the next step
+     (FSAL). The 8(7) pair is not FSAL by construction, so that stage
+     is appended to it.
+
+     The step size is adapted by a PI controller (Gustafsson), which
+     takes the previous step's error into account, damping the
+     oscillation of step sizes a purely error-proportional controller
+     exhibits when the step size is limited by stability.
+
+     The solution within the last step is available from
+     interpolate(), by cubic Hermite interpolation of the values and
+     derivatives at either end of the step, so output can be sampled
+     at arbitrary times without shortening the steps.
+  */
+  class ExplicitRK: public ODESolver
+  {
+    const Minsky& minsky;
+    const std::vector<double>& flowInit;
+  public:
+    /// coefficients of an embedded pair
+    struct Tableau;
+  private:
+    const Tableau& tableau;
+    /// workspace
+    std::vector<double> flow, y1;
+    /// stage derivatives
+    std::vector<std::vector<double> > k;
+    /// values and derivatives at the start and end of the last step
+    std::vector<double> yStart, fStart, yEnd, fEnd;
+    double tStart=0, tEnd=0;
+    bool haveStep=false;
+    /// whether k[0] holds the derivative at the start of the step
+    bool fsal=false;
+    double h; ///< current step size
+    double errPrev=1e-4; ///< error of the last accepted step
+
+    void rhs(double result[], double t, const double sv[]);
+  public:
+    /// @{ statistics
+    unsigned numSteps=0, numRejected=0, numRHS=0;
+    /// @}
+
+    ExplicitRK(const Minsky& minsky, const std::vector<double>& flowInit);
+    void evolve(double& t, double t1, double sv[], unsigned maxSteps=0) override;
+    bool interpolate(double t, double sv[]) const override;
+    bool denseOutput() const override {return true;}
+  };
+}
+
+#endif
@@ -0,0 +1,61 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef LOGSPEC_H
+#define LOGSPEC_H
+
+#include <string>
+#include <vector>
+
+namespace minsky
+{
+  /// condition for logging: the variable must exceed threshold
+  struct LogTrigger
+  {
+    std::string valueId;
+    double threshold=0;
+  };
+
+  /// which variables are written to log files, and when
+  struct LogSpec
+  {
+    /// valueIds of the variables logged, or paths of groups, being
+    /// group titles separated by '/', whose variables are all
+    /// logged. If empty, all variables are logged, otherwise opening a
+    /// log fails if no variable is selected. Takes effect when the
+    /// log is opened.
+    std::vector<std::string> variables;
+    /// log every decimation'th step
+    unsigned decimation=1;
+    /// minimum simulation time between logged steps
+    double minInterval=0;
+    /// log only while all of these conditions hold
+    std::vector<LogTrigger> triggers;
+
+    void clear() {variables.clear(); triggers.clear(); decimation=1; minInterval=0;}
+    void addVariable(const std::string& x) {variables.push_back(x);}
+    void addTrigger(const std::string& valueId, double threshold) {
+      triggers.emplace_back();
+      triggers.back().valueId=valueId;
+      triggers.back().threshold=threshold;
+    }
+  };
+}
+
+#include "logSpec.cd"
+#endif
@@ -21,9 +21,12 @@
 #include "flowCoef.h"
 #include "cairoItems.h"
 
+#include "explicitRK.h"
+#include "rungeKutta.h"
+#include "rosenbrock.h"
+#include "threadPool.h"
+
 #include "TCL_obj_stl.h"
-#include <gsl/gsl_errno.h>
-#include <gsl/gsl_odeiv2.h>
 #include <cairo_base.h>
 
 //#include <schema/schema0.h>
@@ -49,119 +52,189 @@ namespace
       if (!isfinite(y[i])) return false;
     return true;
   }
+}
+
+#include "minskyVersion.h"
+
+#include <ecolab_epilogue.h>
 
-  /*
-    For using GSL Runge-Kutta routines
-  */
 
-  int RKfunction(double t, const double y[], double f[], void *params)
+#include <algorithm>
+using namespace std;
+
+namespace minsky
+{
+  vector<string> Minsky::selectLogColumns() const
   {
-    if (params==NULL) return GSL_EBADFUNC;
-    try
+    for (auto& trigger: logSpec.triggers)
+      if (!variableValues.count(trigger.valueId))
+        throw error("unknown trigger variable %s",trigger.valueId.c_str());
+    vector<string> r;
+    if (logSpec.variables.empty())
       {
-        ((Minsky*)params)->evalEquations(f,t,y);
+        for (auto& v: variableValues)
+          r.push_back(v.first);
+        return r;
       }
-    catch (std::exception& e)
+    set<string> selected;
+    auto select=[&](const string& valueId) {
+      if (selected.insert(valueId).second)
+        r.push_back(valueId);
+    };
+    for (auto& name: logSpec.variables)
+      if (variableValues.count(name))
+        select(name);
+      else
+        {
+          // interpret as a path of group titles
+          GroupPtr g=model;
+          for (size_t start=0; g && start<=name.size();)
+            {
+              size_t end=min(name.find('/',start), name.size());
+              string title=name.substr(start, end-start);
+              GroupPtr child;
+              for (auto& i: g->groups)
+                if (i->title==title)
+                  child=i;
+              g=child;
+              start=end+1;
+            }
+          if (!g)
+            throw error("%s is neither a variable nor a group",name.c_str());
+          g->recursiveDo
+            (&Group::items,
+             [&](Items&, Items::iterator i)
+             {
+               if (auto v=dynamic_cast<VariableBase*>(i->get()))
+                 if (variableValues.count(v->valueId()))
+                   select(v->valueId());
+               return false;
+             });
+        }
+    if (r.empty())
+      throw error("no variables selected for logging");
+    return r;
+  }
+
+  vector<string> Minsky::startLog(LogState& log)
+  {
+    log.columns=selectLogColumns();
+    log.spec=logSpec;
+    log.stepCount=0;
+    log.lastLogTime=-numeric_limits<double>::infinity();
+    log.slots.reset();
+    for (auto other: {&textLogState, &binaryLogState, &liveLogState})
+      if (other!=&log && other->slots && other->columns==log.columns)
+        log.slots=other->slots;
+    if (!log.slots)
       {
-        Tcl_AppendResult(interp(),e.what(),NULL);
-        Tcl_AppendResult(interp(),"\n",NULL);
-        return GSL_EBADFUNC;
+        log.slots=make_shared<vector<LogState::Slot>>();
+        resolveLogSlots(log);
       }
-    return GSL_SUCCESS;
+    vector<string> columns{"time"};
+    columns.insert(columns.end(), log.columns.begin(), log.columns.end());
+    return columns;
   }
 
-  int jacobian(double t, const double y[], double * dfdy, double dfdt[], void * params)
+  void Minsky::openLogFile(const string& name)
   {
-   if (params==NULL) return GSL_EBADFUNC;
-   Minsky::Matrix jac(ValueVector::stockVars.size(), dfdy);
-   try
-     {
-       ((Minsky*)params)->jacobian(jac,t,y);
-     }
-    catch (std::exception& e)
-     {
-       Tcl_AppendResult(interp(),e.what(),NULL);
-       Tcl_AppendResult(interp(),"\n",NULL);
-       return GSL_EBADFUNC;
-     }   
-    return GSL_SUCCESS;
+    auto columns=startLog(textLogState);
+    outputDataFile.reset(new ofstream(name));
+    *outputDataFile<< "#"<<columns[0];
+    for (size_t i=1; i<columns.size(); ++i)
+      *outputDataFile<<" "<<columns[i];
+    *outputDataFile<<'\n';
   }
-}
-
-namespace minsky
-{
 
-  struct RKdata
+  void Minsky::openBinaryLogFile(const string& name)
   {
-    gsl_odeiv2_system sys;
-    gsl_odeiv2_driver* driver;
-
-    static void errHandler(const char* reason, const char* file, int line, int gsl_errno) {
-      throw error("gsl: %s:%d: %s",file,line,reason);
-    }
-
-    RKdata(Minsky* minsky) {
-      gsl_set_error_handler(errHandler);
-      sys.function=RKfunction;
-      sys.jacobian=jacobian;
-      sys.dimension=ValueVector::stockVars.size();
-      sys.params=minsky;
-      const gsl_odeiv2_step_type* stepper;
-      switch (minsky->order)
-        {
-        case 1: 
-          if (!minsky->implicit)
-            throw error("First order explicit solver not available");
-          stepper=gsl_odeiv2_step_rk1imp;
-          break;
-        case 2: 
-          stepper=minsky->implicit? gsl_odeiv2_step_rk2imp: gsl_odeiv2_step_rk2;
-          break;
-        case 4:
-          stepper=minsky->implicit? gsl_odeiv2_step_rk4imp: gsl_odeiv2_step_rkf45;
-          break;
-        default:
-          throw error("order %d solver not supported",minsky->order);
-        }
-      driver = gsl_odeiv2_driver_alloc_y_new
-        (&sys, stepper, minsky->stepMax, minsky->epsAbs, 
-         minsky->epsRel);
-      gsl_odeiv2_driver_set_hmax(driver, minsky->stepMax);
-      gsl_odeiv2_driver_set_hmin(driver, minsky->stepMin);
-    }
-    ~RKdata() {gsl_odeiv2_driver_free(driver);}
-  };
-}
+    binaryLogFile.reset(new BinaryLog(name, startLog(binaryLogState)));
+  }
 
-#include "minskyVersion.h"
+  void Minsky::closeLogFile()
+  {
+    outputDataFile.reset();
+    if (auto log=binaryLogFile)
+      {
+        binaryLogFile.reset();
+        log->close();
+      }
+  }
 
-#include <ecolab_epilogue.h>
+  void Minsky::openLiveOutput(const string& name, unsigned capacity)
+  {
+    liveOutput.reset(new SharedRingWriter(name, startLog(liveLogState), capacity));
+  }
 
+  void Minsky::resolveLogSlots(LogState& log) const
+  {
+    log.slots->clear();
+    for (auto& c: log.columns)
+      {
+        auto v=variableValues.find(c);
+        if (v!=variableValues.end())
+          log.slots->push_back({v->second.idx(), v->second.isFlowVar()});
+        else
+          log.slots->push_back({-1, true});
+      }
+  }
 
-#include <algorithm>
-using namespace std;
+  bool Minsky::logDue(LogState& log)
+  {
+    // decimation counts steps, whether or not they are otherwise due
+    if (log.stepCount++%max(1U, log.spec.decimation)!=0) return false;
+    if (t-log.lastLogTime<log.spec.minInterval*(1-1e-10)) return false;
+    for (auto& trigger: log.spec.triggers)
+      {
+        auto v=variableValues.find(trigger.valueId);
+        if (v==variableValues.end() || !(v->second.value()>trigger.threshold))
+          return false;
+      }
+    log.lastLogTime=t;
+    return true;
+  }
 
-namespace minsky
-{
-  void Minsky::openLogFile(const string& name)
+  void Minsky::fillLogRow(const LogState& log)
   {
-    outputDataFile.reset(new ofstream(name));
-    *outputDataFile<< "#time";
-    for (auto& v: variableValues)
-      *outputDataFile<<" "<<v.first;
-    *outputDataFile<<endl;
+    logRow.resize(log.slots->size()+1);
+    logRow[0]=t;
+    double* row=&logRow[1];
+    for (auto& s: *log.slots)
+      {
+        auto& values=s.flow? flowVars: stockVars;
+        *row++=s.idx>=0 && size_t(s.idx)<values.size()? values[s.idx]: nan("");
+      }
   }
 
-  /// write current state of all variables to the log file
-  void Minsky::logVariables() const
+  void Minsky::logVariables()
   {
-    if (outputDataFile)
+    // logs with the same columns share the row filled for the first
+    const vector<LogState::Slot>* filled=nullptr;
+    auto rowDue=[&](LogState& log) {
+      if (!logDue(log)) return false;
+      if (filled!=log.slots.get())
+        {
+          fillLogRow(log);
+          filled=log.slots.get();
+        }
+      return true;
+    };
+
+    if (outputDataFile && rowDue(textLogState))
       {
-        *outputDataFile<<t;
-        for (auto& v: variableValues)
-          *outputDataFile<<" "<<v.second.value();
-        *outputDataFile<<endl;
+        *outputDataFile<<logRow[0];
+        for (size_t i=1; i<logRow.size(); ++i)
+          *outputDataFile<<" "<<logRow[i];
+        *outputDataFile<<'\n';
       }
+    if (binaryLogFile && rowDue(binaryLogState))
+      {
+        double* row=binaryLogFile->beginRow();
+        copy(logRow.begin(), logRow.end(), row);
+        binaryLogFile->commitRow();
+      }
+    if (liveOutput && rowDue(liveLogState))
+      liveOutput->append(&logRow[0]);
   }        
         
       
@@ -401,6 +474,7 @@ namespace minsky
 
   void Minsky::constructEquations()
   {
+    LocalMinsky lm(*this); // variable values refer to this model's state
     if (cycleCheck()) throw error("cyclic network detected");
     garbageCollect();
     equations.clear();
@@ -408,10 +482,23 @@ namespace minsky
 
     MathDAG::SystemOfEquations system(*this);
     assert(variableValues.validEntries());
+    system.simplify(!symbolicParameters);
     system.populateEvalOpVector(equations, integrals);
     assert(variableValues.validEntries());
+    mergedSubexpressions=system.numMergedSubexpressions();
+    tape.compile(equations);
+    // until the Godley tables are initialised, the full tape is needed
+    rhsTape=jacTape=tape;
+    sparseJacobian.clear();
+
+    attachPlots();
 
-    // attach the plots
+    for (EvalOpVector::iterator e=equations.begin(); e!=equations.end(); ++e)
+      (*e)->reset();
+  }
+
+  void Minsky::attachPlots()
+  {
     model->recursiveDo
       (&Group::items,
        [&](Items& m, Items::iterator i)
@@ -431,9 +518,92 @@ namespace minsky
            }
          return false;
        });
+  }
 
-    for (EvalOpVector::iterator e=equations.begin(); e!=equations.end(); ++e)
-      (*e)->reset();
+  void Minsky::renumberVariables()
+  {
+    // flow variables in order of first access by the equations, then
+    // by the Godley tables and integrals
+    vector<int> flowMap(flowVars.size(),-1), stockMap(stockVars.size());
+    int next=0;
+    auto visit=[&](int i) {
+      if (i>=0 && size_t(i)<flowMap.size() && flowMap[i]<0) flowMap[i]=next++;
+    };
+    for (size_t i=0; i<tape.size(); ++i)
+      {
+        int nArgs=tape.ops[i]->numArgs();
+        if (nArgs>0 && (tape.flags[i]&EvalTape::flow1)) visit(tape.in1[i]);
+        if (nArgs>1 && (tape.flags[i]&EvalTape::flow2)) visit(tape.in2[i]);
+        visit(tape.out[i]);
+      }
+    for (size_t k=0; k<evalGodley.flowIdx().size(); ++k)
+      visit(evalGodley.flowIdx()[k]);
+    for (auto& i: integrals)
+      if (i.input.isFlowVar())
+        visit(i.input.idx());
+    for (size_t i=0; i<flowMap.size(); ++i)
+      visit(i);
+
+    // stock variables in reverse Cuthill-McKee order of the Jacobian
+    SparseJacobian structure;
+    structure.analyse(tape, evalGodley, integrals, stockVars.size(), flowVars.size());
+    auto order=structure.reverseCuthillMcKee();
+    for (size_t k=0; k<order.size(); ++k)
+      stockMap[order[k]]=k;
+
+    auto permute=[](vector<double>& x, const vector<int>& map) {
+      vector<double> r(x.size());
+      for (size_t i=0; i<x.size(); ++i) r[map[i]]=x[i];
+      x.swap(r);
+    };
+    permute(flowVars, flowMap);
+    permute(stockVars, stockMap);
+
+    for (auto& v: variableValues)
+      v.second.renumber(flowMap, stockMap);
+    for (auto& e: equations)
+      {
+        e->out=flowMap[e->out];
+        if (e->numArgs()>0)
+          e->in1=(e->flow1? flowMap: stockMap)[e->in1];
+        if (e->numArgs()>1)
+          e->in2=(e->flow2? flowMap: stockMap)[e->in2];
+      }
+    for (auto& i: integrals)
+      {
+        i.stock.renumber(flowMap, stockMap);
+        i.input.renumber(flowMap, stockMap);
+      }
+
+    // collect output ports first, so each is renumbered once
+    set<Port*> ports;
+    auto addPorts=[&](Item& item) {
+      for (auto& p: item.ports)
+        if (p && !p->input())
+          ports.insert(p.get());
+    };
+    model->recursiveDo
+      (&Group::items,
+       [&](Items&, Items::iterator i)
+       {
+         addPorts(**i);
+         if (auto g=dynamic_cast<GodleyIcon*>(i->get()))
+           {
+             for (auto& v: g->flowVars) addPorts(*v);
+             for (auto& v: g->stockVars) addPorts(*v);
+           }
+         return false;
+       });
+    for (auto p: ports)
+      {
+        VariableValue v=p->getVariableValue();
+        v.renumber(flowMap, stockMap);
+        p->setVariableValue(v);
+      }
+
+    tape.compile(equations);
+    initGodleys();
+    attachPlots();
   }
 
   std::set<string> Minsky::matchingTableColumns(GodleyTable& currTable, GodleyAssetClass::AssetClass ac)
@@ -656,13 +826,55 @@ namespace minsky
 
   void Minsky::reset()
   {
-    EvalOpBase::t=t=0;
+    LocalMinsky lm(*this);
+    t=0;
     constructEquations();
+    // variables may have moved
+    for (auto log: {&textLogState, &binaryLogState, &liveLogState})
+      if (log->slots)
+        resolveLogSlots(*log);
     // if no stock variables in system, add a dummy stock variable to
     // make the simulation proceed
     if (stockVars.empty()) stockVars.resize(1,0);
 
     initGodleys();
+    // lay out the variables in the order they are accessed
+    renumberVariables();
+
+    // eliminate operations that the stock derivatives do not depend on
+    vector<int> rhsFlows;
+    for (size_t k=0; k<evalGodley.flowIdx().size(); ++k)
+      rhsFlows.push_back(evalGodley.flowIdx()[k]);
+    for (auto& i: integrals)
+      if (i.input.isFlowVar())
+        rhsFlows.push_back(i.input.idx());
+    jacTape.select(tape, tape.liveInstructions(rhsFlows));
+    rhsTape=jacTape;
+    // intermediate results of rhsTape are recomputed by tape before
+    // output, so their slots can be shared
+    rhsTape.allocateSlots(rhsFlows, tape.out);
+
+    sparseJacobian.analyse(jacTape, evalGodley, integrals, stockVars.size(), flowVars.size());
+
+    // evaluate independent operations concurrently. Levels too small
+    // to be worth distributing are evaluated serially.
+    shared_ptr<ThreadPool> pool;
+    if (evalThreads!=1)
+      pool=make_shared<ThreadPool>(evalThreads);
+    tape.schedule(pool);
+    rhsTape.schedule(pool);
+    jacTape.schedule(pool);
+    tape.deferChecks=rhsTape.deferChecks=jacTape.deferChecks=deferFiniteChecks;
+    // only tape's values are displayed, so only it need compute the
+    // unselected cases of switches
+    tape.evalAllCases=true;
+    rhsTape.evalAllCases=jacTape.evalAllCases=false;
+
+    jitEquations.reset();
+    // the compiled derivatives also read the values of operands
+    // after evaluation, so are compiled from jacTape
+    if (jit)
+      jitEquations=JitEquations::compile(jacTape, evalGodley, integrals, stockVars.size());
 
     model->recursiveDo
       (&Group::items,
@@ -674,55 +886,48 @@ namespace minsky
        });
 
     if (stockVars.size()>0)
-      {
-        if (order==1 && !implicit)
-          ode.reset(); // do explicit Euler
-        else
-          ode.reset(new RKdata(this)); // set up GSL ODE routines
-      }
+      ode=createODESolver(*this, flowVars);
 
     flags &= ~reset_needed;
     // update flow variable
-    for (size_t i=0; i<equations.size(); ++i)
-      equations[i]->eval(&flowVars[0], &stockVars[0]);
+    tape.eval(flowVars.data(), stockVars.data(), t);
+  }
+
+  unique_ptr<ODESolver> createODESolver(const Minsky& m, const vector<double>& flowInit)
+  {
+    switch (m.solver)
+      {
+      case ODESolverType::gsl:
+        if (m.order==1 && !m.implicit)
+          return nullptr; // do explicit Euler
+        return unique_ptr<ODESolver>(new RKdata(m, flowInit));
+      case ODESolverType::rosenbrock:
+        return unique_ptr<ODESolver>(new Rosenbrock(m, flowInit));
+      case ODESolverType::explicitRK:
+        return unique_ptr<ODESolver>(new ExplicitRK(m, flowInit));
+      default:
+        throw error("unknown solver type");
+      }
   }
 
   void Minsky::step()
   {
+    LocalMinsky lm(*this);
     if (reset_flag())
       reset();
 
     if (ode)
-      {
-        gsl_odeiv2_driver_set_nmax(ode->driver, nSteps);
-        int err=gsl_odeiv2_driver_apply(ode->driver, &t, numeric_limits<double>::max(), 
-                                        &stockVars[0]);
-        switch (err)
-          {
-          case GSL_SUCCESS: case GSL_EMAXITER: break;
-          case GSL_FAILURE:
-            throw error("unspecified error GSL_FAILURE returned");
-          case GSL_EBADFUNC: 
-            gsl_odeiv2_driver_reset(ode->driver);
-            throw error("Invalid arithmetic operation detected");
-          default:
-            throw error("gsl error: %s",gsl_strerror(err));
-          }
-      }
+      ode->evolve(t, numeric_limits<double>::max(), &stockVars[0], nSteps);
     else // do explicit Euler method
-      {
-        vector<double> d(stockVars.size());
-        for (int i=0; i<nSteps; ++i, t+=stepMax)
-          {
-            evalEquations(&d[0], t, &stockVars[0]);
-            for (size_t j=0; j<d.size(); ++j)
-              stockVars[j]+=d[j];
-          }
-      }
+      for (int i=0; i<nSteps; ++i)
+        {
+          flowScratch=flowVars;
+          eulerStep(t, numeric_limits<double>::max(), &stockVars[0],
+                    derivScratch, &flowScratch[0]);
+        }
 
     // update flow variables
-    for (size_t i=0; i<equations.size(); ++i)
-      equations[i]->eval(&flowVars[0], &stockVars[0]);
+    tape.eval(flowVars.data(), stockVars.data(), t);
 
     logVariables();
 
@@ -732,6 +937,87 @@ namespace minsky
        {(*i)->updateIcon(t); return false;});
   }
 
+  void Minsky::runUntil(double tEnd, double outputInterval, vector<double>& samples)
+  {
+    LocalMinsky lm(*this);
+    if (reset_flag())
+      reset();
+    if (tEnd<t)
+      throw error("cannot run backwards from t=%g to %g",t,tEnd);
+
+    // output times are multiples of outputInterval, excluding the
+    // current time, which has already been output
+    double k=0;
+    if (outputInterval>0)
+      {
+        k=ceil(t/outputInterval);
+        if (k*outputInterval<=t+1e-9*outputInterval) ++k;
+        samples.reserve(samples.size()+sampleWidth()*size_t((tEnd-t)/outputInterval+2));
+      }
+    auto sampleTime=[&]() {return outputInterval>0? min(k*outputInterval, tEnd): tEnd;};
+
+    // output the state at the current time, or if \a interpolated,
+    // that held in sampleStocks at time ts
+    vector<double> sampleStocks(stockVars.size());
+    auto output=[&](double ts, bool interpolated) {
+      double tNow=t;
+      if (interpolated)
+        {
+          stockVars.swap(sampleStocks);
+          t=ts;
+        }
+      tape.eval(flowVars.data(), stockVars.data(), t);
+      samples.push_back(t);
+      samples.insert(samples.end(), stockVars.begin(), stockVars.end());
+      samples.insert(samples.end(), flowVars.begin(), flowVars.end());
+      logVariables();
+      model->recursiveDo
+        (&Group::items, 
+         [&](Items&, Items::iterator i) 
+         {(*i)->updateIcon(t); return false;});
+      if (interpolated)
+        {
+          stockVars.swap(sampleStocks);
+          t=tNow;
+        }
+    };
+
+    bool dense=ode && ode->denseOutput();
+    for (;;)
+      {
+        double ts=sampleTime();
+        if (t<ts)
+          {
+            if (dense)
+              ode->evolve(t, tEnd, &stockVars[0], 1);
+            else if (ode)
+              ode->evolve(t, ts, &stockVars[0]);
+            else
+              {
+                flowScratch=flowVars;
+                eulerStep(t, ts, &stockVars[0], derivScratch, &flowScratch[0]);
+              }
+            continue;
+          }
+        if (ts<t)
+          {
+            if (!ode->interpolate(ts, &sampleStocks[0]))
+              throw error("solution not available at t=%g",ts);
+            output(ts, true);
+          }
+        else
+          output(ts, false);
+        if (ts>=tEnd) break;
+        ++k;
+      }
+  }
+
+  void Minsky::sweep()
+  {
+    reset();
+    parameterSweep.run(*this);
+  }
+
   string Minsky::diagnoseNonFinite() const
   {
     // firstly check if any variables are not finite
@@ -749,18 +1035,37 @@ namespace minsky
 
   void Minsky::evalEquations(double result[], double t, const double vars[])
   {
-    EvalOpBase::t=t;
     // firstly evaluate the flow variables. Initialise to flowVars so
     // that no input vars are correctly initialised
-    vector<double> flow(flowVars);
-    for (size_t i=0; i<equations.size(); ++i)
-      equations[i]->eval(&flow[0], vars);
+    flowScratch=flowVars;
+    evalRHS(result, t, vars, &flowScratch[0]);
+  }
+
+  void Minsky::eulerStep(double& t, double t1, double sv[], vector<double>& d,
+                         double flow[]) const
+  {
+    double h=min(stepMax, t1-t);
+    d.resize(stockVars.size());
+    evalRHS(&d[0], t, sv, flow);
+    for (size_t j=0; j<d.size(); ++j)
+      sv[j]+=h*d[j];
+    t = h<t1-t? t+h: t1;
+  }
+
+  void Minsky::evalRHS(double result[], double t, const double vars[], double flow[]) const
+  {
+    // compiled code only writes to the same flow variables as the
+    // interpreter, so on failure the interpreter can simply be rerun
+    // to diagnose the problem
+    if (jitEquations && jitEquations->rhs(t, vars, result, flow)==0)
+      return;
+    rhsTape.eval(flow, vars, t);
 
     // then create the result using the Godley table
     for (size_t i=0; i<stockVars.size(); ++i) result[i]=0;
-    evalGodley.eval(result, &flow[0]);
+    evalGodley.eval(result, flow);
     // integrations are kind of a copy
-    for (vector<Integral>::iterator i=integrals.begin(); i<integrals.end(); ++i)
+    for (vector<Integral>::const_iterator i=integrals.begin(); i<integrals.end(); ++i)
       {
         if (i->input.idx()<0)
           {
@@ -774,33 +1079,82 @@ namespace minsky
 
   void Minsky::jacobian(Matrix& jac, double t, const double sv[])
   {
-    EvalOpBase::t=t;
+    if (sparseJacobian.size()!=stockVars.size())
+      sparseJacobian.analyse(jacTape, evalGodley, integrals, stockVars.size(), flowVars.size());
     // firstly evaluate the flow variables. Initialise to flowVars so
     // that no input vars are correctly initialised
-    vector<double> flow=flowVars;
-    for (size_t i=0; i<equations.size(); ++i)
-      equations[i]->eval(&flow[0], sv);
+    flowScratch=flowVars;
+    evalJacobian(jac, t, sv, &flowScratch[0], jacValues, jacScratch);
+  }
 
-    // then determine the derivatives with respect to variable j
-    for (size_t j=0; j<stockVars.size(); ++j)
-      {
-        vector<double> ds(stockVars.size()), df(flowVars.size());
-        ds[j]=1;
-        for (size_t i=0; i<equations.size(); ++i)
-          equations[i]->deriv(&df[0], &ds[0], sv, &flow[0]);
-        vector<double> d(stockVars.size());
-        evalGodley.eval(&d[0], &df[0]);
-        for (vector<Integral>::iterator i=integrals.begin(); 
-             i!=integrals.end(); ++i)
-          {
-            assert(i->stock.idx()>=0 && i->input.idx()>=0);
-            d[i->stock.idx()] = 
-              i->input.isFlowVar()? df[i->input.idx()]: ds[i->input.idx()];
-          }
-        for (size_t i=0; i<stockVars.size(); i++)
-          jac(i,j)=d[i];
-      }
-  
+  void Minsky::evalJacobian(Matrix& jac, double t, const double sv[], double flow[],
+                            vector<double>& values, vector<double>& scratch) const
+  {
+    evalSparseJacobian(values, t, sv, flow, scratch);
+    for (size_t i=0; i<stockVars.size(); ++i)
+      for (size_t j=0; j<stockVars.size(); ++j)
+        jac(i,j)=0;
+    for (size_t i=0; i<stockVars.size(); ++i)
+      for (int k=sparseJacobian.rowPtr[i]; k<sparseJacobian.rowPtr[i+1]; ++k)
+        jac(i,sparseJacobian.colIdx[k])=values[k];
+  }
+
+  void Minsky::evalSparseJacobian(vector<double>& values, double t, const double sv[],
+                                 double flow[], vector<double>& scratch) const
+  {
+    if (sparseJacobian.size()!=stockVars.size())
+      throw error("Jacobian structure not analysed");
+    values.resize(sparseJacobian.nnz());
+    // colours are independent, so are distributed across the
+    // equations' thread pool, each task with its own workspace
+    auto& pool=jacTape.threadPool();
+    size_t nTasks=pool?
+      max(size_t(1), min(size_t(pool->size()), sparseJacobian.numColours())): 1;
+    size_t stride=2*stockVars.size()+flowVars.size();
+    scratch.resize(nTasks*stride);
+
+    bool useJit=jitEquations &&
+      jitEquations->rhs(t, sv, &scratch[stockVars.size()], flow)==0;
+    if (!useJit)
+      jacTape.eval(flow, sv, t);
+
+    // columns of the same colour share no row, so can be computed
+    // together with one directional derivative
+    auto task=[&](size_t k) {
+      double* ds=&scratch[k*stride];
+      double* d=ds+stockVars.size();
+      double* df=d+stockVars.size();
+      for (size_t c=k; c<sparseJacobian.numColours(); c+=nTasks)
+        {
+          sparseJacobian.seed(ds, c);
+          for (size_t i=0; i<flowVars.size(); ++i) df[i]=0;
+          if (useJit && jitEquations->deriv(t, sv, flow, ds, df, d)==0)
+            {
+              sparseJacobian.scatter(&values[0], c, d);
+              continue;
+            }
+          // interpreted path, which also diagnoses any problem
+          // reported by the compiled version
+          jacTape.deriv(df, ds, sv, flow);
+          for (size_t i=0; i<stockVars.size(); ++i) d[i]=0;
+          // the Godley rows of the Jacobian are the constant Godley
+          // matrix applied to the flow derivatives, by the same CSR kernel
+          evalGodley.eval(d, df);
+          for (vector<Integral>::const_iterator i=integrals.begin(); 
+               i!=integrals.end(); ++i)
+            {
+              assert(i->stock.idx()>=0 && i->input.idx()>=0);
+              d[i->stock.idx()] = 
+                i->input.isFlowVar()? df[i->input.idx()]: ds[i->input.idx()];
+            }
+          sparseJacobian.scatter(&values[0], c, d);
+        }
+    };
+    if (nTasks>1)
+      // std::ref avoids allocating a copy of task
+      pool->parallelFor(nTasks, std::ref(task));
+    else
+      task(0);
   }
 
   void Minsky::save(const std::string& filename)
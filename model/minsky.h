@@ -25,6 +25,13 @@
 #include "godleyIcon.h"
 #include "operation.h"
 #include "evalOp.h"
+#include "evalTape.h"
+#include "jit.h"
+#include "sparseJacobian.h"
+#include "odeSolver.h"
+#include "binaryLog.h"
+#include "logSpec.h"
+#include "sharedRing.h"
 #include "evalGodley.h"
 #include "wire.h"
 #include "plotWidget.h"
@@ -34,6 +41,7 @@
 #include "latexMarkup.h"
 #include "integral.h"
 #include "variableValue.h"
+#include "sweep.h"
 
 #include <vector>
 #include <string>
@@ -52,16 +60,60 @@ namespace minsky
   using namespace std;
   using classdesc::shared_ptr;
 
-  struct RKdata; // an internal structure for holding Runge-Kutta data
 
   // a place to put working variables of the Minsky class that needn't
   // be serialised.
   struct MinskyExclude
   {
     EvalOpVector equations;
+    /// flattened form of equations, evaluated to update all flow
+    /// variables for output
+    EvalTape tape;
+    /// subset of tape needed to compute the derivatives of the stock
+    /// variables, ie excluding operations only feeding plots, logs
+    /// and displayed variables. Used by the solvers.
+    EvalTape rhsTape;
+    /// rhsTape before its slots are shared. The derivatives read the
+    /// values of each instruction's operands after the whole tape
+    /// has been evaluated, so need every intermediate value to
+    /// remain in its slot. Used for the Jacobian.
+    EvalTape jacTape;
+    /// natively compiled equations, if enabled and available
+    std::shared_ptr<JitEquations> jitEquations;
+    /// sparsity structure of the Jacobian, analysed on reset
+    SparseJacobian sparseJacobian;
+    /// number of operations merged into structurally identical
+    /// subexpressions by the last constructEquations
+    size_t mergedSubexpressions=0;
+    /// workspace for evalEquations, jacobian and the explicit Euler
+    /// solver, avoiding allocation on each call
+    vector<double> flowScratch, derivScratch, jacValues, jacScratch;
     vector<Integral> integrals;
-    shared_ptr<RKdata> ode;
+    /// ODE solver, null for explicit Euler
+    shared_ptr<ODESolver> ode;
     shared_ptr<ofstream> outputDataFile;
+    std::shared_ptr<BinaryLog> binaryLogFile;
+    std::shared_ptr<SharedRingWriter> liveOutput;
+    /// what an open log records, fixed when it is opened, and its
+    /// decimation state. Each kind of log has its own, so opening
+    /// one does not disturb the others.
+    struct LogState
+    {
+      LogSpec spec;
+      /// valueIds of the variables logged
+      vector<string> columns;
+      /// where each column's value is held, resolved when the log is
+      /// opened and on reset, rather than looked up by name each
+      /// row. Logs with the same columns share these, and so a row.
+      struct Slot {int idx; bool flow;};
+      shared_ptr<vector<Slot>> slots;
+      /// number of steps since the log was opened, and time last logged
+      unsigned long stepCount=0;
+      double lastLogTime=0;
+    };
+    LogState textLogState, binaryLogState, liveLogState;
+    /// workspace for logVariables
+    vector<double> logRow;
 
     enum StateFlags {is_edited=1, reset_needed=2};
     int flags=reset_needed;
@@ -98,7 +150,7 @@ namespace minsky
 
   enum ItemType {wire, op, var, group, godley, plot};
 
-  class Minsky: public ValueVector, public Exclude<MinskyExclude>
+  class Minsky: public SimulationState, public Exclude<MinskyExclude>
   {
     CLASSDESC_ACCESS(Minsky);
 
@@ -106,8 +158,25 @@ namespace minsky
     /// NaN. Either a variable name, or and operator type.
     std::string diagnoseNonFinite() const;
 
-    /// write current state of all variables to the log file
-    void logVariables() const;
+    /// write current state of the variables selected by logSpec to
+    /// the log files, if due
+    void logVariables();
+    /// true if \a log is due a row at the current time, which
+    /// advances its decimation
+    bool logDue(LogState& log);
+    /// fill logRow with the current values of \a log's columns
+    void fillLogRow(const LogState& log);
+    /// set the slots of \a log's columns from variableValues
+    void resolveLogSlots(LogState& log) const;
+    /// valueIds selected by logSpec, being all variables if
+    /// logSpec.variables is empty
+    /// @throw ecolab::error if an entry is neither a variable nor a
+    /// group, or if the entries select no variables
+    vector<string> selectLogColumns() const;
+    /// record logSpec and the columns it selects in \a log, and
+    /// restart its decimation, returning the column names, starting
+    /// with time
+    vector<string> startLog(LogState& log);
 
   protected:
     /// contents of current selection
@@ -222,17 +291,49 @@ namespace minsky
     /// if there are some
     bool cycleCheck() const;
 
+    /// variables logged, and when
+    LogSpec logSpec;
     /// opens the log file, and writes out a header line describing
-    /// names of all variables
+    /// names of the variables selected by logSpec
     void openLogFile(const string&);
+    /// as openLogFile, but in the binary format of BinaryLog, which
+    /// is written by a background thread
+    void openBinaryLogFile(const string&);
     /// closes log file
-    void closeLogFile() {outputDataFile.reset();}
+    /// @throw ecolab::error if the binary log could not be written in full
+    void closeLogFile();
+    /// convert a log written by openBinaryLogFile to the text format
+    /// written by openLogFile
+    void convertLogFile(const string& binary, const string& text) const
+    {convertBinaryLog(binary, text);}
+    /// write the variables selected by logSpec, when logged, to a
+    /// SharedRingWriter of \a capacity rows in file \a name, for
+    /// consumption by other processes while the simulation runs
+    void openLiveOutput(const string& name, unsigned capacity=4096);
+    void closeLiveOutput() {liveOutput.reset();}
 
     /// construct the equations based on input data
     /// @throws ecolab::error if the data is inconsistent
     void constructEquations();
+    /// connect plots to the variables wired to them
+    void attachPlots();
+    /// permute the flow and stock variables into the order they are
+    /// accessed by the equations, updating all references to them.
+    /// Stock variables are placed in reverse Cuthill-McKee order of
+    /// the Jacobian. Called by reset, once the Godley tables are
+    /// initialised.
+    void renumberVariables();
     /// evaluate the equations (stockVars.size() of them)
     void evalEquations(double result[], double t, const double vars[]);
+    /// as for evalEquations, but using \a flow (initialised to the
+    /// flow variable values to use) as workspace, leaving this
+    /// unchanged. Safe to call concurrently with distinct \a flow.
+    void evalRHS(double result[], double t, const double vars[], double flow[]) const;
+    /// advance \a sv from \a t by an explicit Euler step of stepMax,
+    /// shortened if necessary to end exactly at \a t1. \a d is
+    /// derivative workspace, and \a flow as for evalRHS. Used by
+    /// step(), runUntil() and parameter sweeps alike.
+    void eulerStep(double& t, double t1, double sv[], vector<double>& d, double flow[]) const;
 
     /// returns number of equations
     size_t numEquations() const {return 0;}//equations.size();}
@@ -244,6 +345,17 @@ namespace minsky
 
     typedef MinskyMatrix Matrix; 
     void jacobian(Matrix& jac, double t, const double vars[]);
+    /// as for jacobian, with \a flow as for evalRHS. \a values and \a
+    /// scratch are workspace, sized on first use, so that repeated
+    /// calls do not allocate
+    void evalJacobian(Matrix& jac, double t, const double vars[], double flow[],
+                      std::vector<double>& values, std::vector<double>& scratch) const;
+    /// compute the structural nonzeros of the Jacobian into \a
+    /// values, in the compressed sparse row order of
+    /// sparseJacobian. \a scratch as for evalJacobian
+    void evalSparseJacobian(std::vector<double>& values, double t,
+                            const double vars[], double flow[],
+                            std::vector<double>& scratch) const;
     
     // Runge-Kutta parameters
     double stepMin{0}; ///< minimum step size
@@ -251,13 +363,59 @@ namespace minsky
     int nSteps{1};     ///< number of steps per GUI update
     double epsAbs{1e-3};     ///< absolute error
     double epsRel{1e-2};     ///< relative error
-    int order{4};     /// solver order: 1,2 or 4
+    int order{4};     /// solver order: 1,2 or 4, or 8 for the native explicit solver
     bool implicit{false}; /// true is implicit method used, false if explicit
+    /// solver backend. order applies to the GSL and native explicit
+    /// solvers, implicit only to the GSL solvers
+    ODESolverType::Type solver{ODESolverType::gsl};
     int simulationDelay{0}; /// delay in milliseconds inserted between iteration steps
+    bool jit{false}; ///< compile equations to native code on reset, where possible
+    /// number of threads evaluating the equations and Jacobian of
+    /// large models (1=serial, 0=number of cores). Takes effect on
+    /// reset.
+    unsigned evalThreads{1};
+    /// check for NaN or infinite values once each evaluation of the
+    /// equations is complete, rather than after every operation,
+    /// rerunning the evaluation only to locate an error. Errors are
+    /// reported as before.
+    bool deferFiniteChecks{false};
+    /// locate the times at which comparisons, logical operations,
+    /// floor, frac and switches change their result within each step
+    /// of the GSL solvers, and restart integration there, rather
+    /// than stepping across the discontinuity
+    bool locateEvents{false};
+    /// keep parameters and constant variables as variables when
+    /// simplifying the equations, so they can be altered by sliders
+    /// or swept. If false, they are
+    /// folded into the equations as constants, and changes only take
+    /// effect on reset.
+    bool symbolicParameters{true};
+    /// keep a binary copy of data files read by data operations
+    /// alongside them, for faster reloading
+    bool cacheDataFiles{false};
 
     double t{0}; ///< time
     void reset(); ///<resets the variables back to their initial values
     void step();  ///< step the equations (by n steps, default 1)
+    /**
+       Integrate to exactly time \a tEnd, sampling the solution at
+       each multiple of \a outputInterval between the current time
+       and \a tEnd, and at \a tEnd itself (only at \a tEnd if \a
+       outputInterval is not positive). Each sample is appended to \a
+       samples as sampleWidth() values: the time, followed by the
+       stock variables, then the flow variables. Icons, plots and the
+       log are updated at each sample, rather than at each step.
+       Solvers supporting interpolation step freely past output
+       times, others are stopped at each output time.
+    */
+    void runUntil(double tEnd, double outputInterval, std::vector<double>& samples);
+    /// number of values per sample written by runUntil
+    size_t sampleWidth() const {return 1+stockVars.size()+flowVars.size();}
+
+    /// specification and results of parameter sweeps
+    ParameterSweep parameterSweep;
+    /// reset the model, then run parameterSweep on it
+    void sweep();
 
     /// save to a file
     void save(const std::string& filename);
@@ -323,11 +481,17 @@ namespace minsky
   Minsky& minsky();
   /// const version to help in const correctness
   inline const Minsky& cminsky() {return minsky();}
-  /// RAII set the minsky object to a different one for the current scope.
-  struct LocalMinsky
+  /// RAII set the minsky object to a different one for the current
+  /// scope. The setting is per thread, so different threads may work
+  /// on different models concurrently.
+  class LocalMinsky
   {
+    Minsky* prev;
+  public:
     LocalMinsky(Minsky& m);
     ~LocalMinsky();
+    LocalMinsky(const LocalMinsky&)=delete;
+    void operator=(const LocalMinsky&)=delete;
   };
 
 
@@ -0,0 +1,67 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef ODESOLVER_H
+#define ODESOLVER_H
+
+#include <memory>
+#include <vector>
+
+namespace minsky
+{
+  class Minsky;
+
+  /// ODE solver backends
+  struct ODESolverType
+  {
+    /// gsl: GSL odeiv2 Runge-Kutta steppers, selected by order and
+    /// implicit. rosenbrock: native sparse implicit solver.
+    /// explicitRK: native embedded explicit Runge-Kutta pairs,
+    /// selected by order
+    enum Type {gsl, rosenbrock, explicitRK};
+  };
+
+  /// interface to a solver integrating the equations of a model
+  class ODESolver
+  {
+  public:
+    virtual ~ODESolver() {}
+    /// advance stock variables \a sv from time \a t towards \a t1,
+    /// taking at most \a maxSteps steps (0 for no limit). \a t is
+    /// updated to the time reached.
+    /// @throw ecolab::error if integration fails
+    virtual void evolve(double& t, double t1, double sv[], unsigned maxSteps=0)=0;
+    /// set \a sv to the solution at time \a t, which must lie within
+    /// the last step taken by evolve.
+    /// @return false if \a t lies outside the last step, or the
+    /// solver does not support interpolation
+    virtual bool interpolate(double t, double sv[]) const {return false;}
+    /// true if interpolate is supported
+    virtual bool denseOutput() const {return false;}
+  };
+
+  /// create the solver selected by the settings of \a minsky, whose
+  /// equations are evaluated with flow variables initialised from \a
+  /// flowInit. Returns null if explicit Euler has been selected,
+  /// which is handled by the caller.
+  std::unique_ptr<ODESolver> createODESolver
+  (const Minsky& minsky, const std::vector<double>& flowInit);
+}
+
+#include "odeSolver.cd"
+#endif
@@ -26,6 +26,7 @@
 
 #include <math.h>
 #include <sstream>
+#include <algorithm>
 
 #ifndef M_PI
 #define M_PI		3.14159265358979323846
@@ -323,64 +324,152 @@ namespace minsky
       }
   }
 
-  void DataOp::readData(const string& fileName)
+  void DataOp::readDataColumn(const string& fileName, unsigned column)
   {
-    ifstream f(fileName.c_str());
-    data.clear();
-    // for now, we just read pairs of numbers, separated by
-    // whitespace. Later, we need to add in the smarts to handle a
-    // variety of CSV formats
-    double x, y;
-    while (f>>x>>y)
-      data[x]=y; // TODO: throw if more than one equal value of x provided?
+    auto data=DataSet::load(fileName, minsky().cacheDataFiles);
+    if (column<1 || column>data->y.size())
+      throw error("%s has no data column %d",fileName.c_str(),column);
+    xData=data->x;
+    yData=data->y[column-1];
+    checkUniform();
 
     // trim any leading directory
     size_t p=fileName.rfind('/');
     // '/' is guaranteed not to be in fileName, so we can use that as
     // a delimiter
     description = "\\verb/"+
-      ((p!=string::npos)? fileName.substr(p+1): fileName) + "/";
+      ((p!=string::npos)? fileName.substr(p+1): fileName);
+    if (data->y.size()>1)
+      {
+        string heading=data->names[column];
+        heading.erase(remove(heading.begin(), heading.end(), '/'), heading.end());
+        description+=":"+heading;
+      }
+    description+="/";
   }
 
-  double DataOp::interpolate(double x) const
+  void DataOp::setData(const map<double, double>& data)
   {
-    // not terribly sensible, but need to return something
-    if (data.empty()) return 0;
-
-    map<double, double>::const_iterator v=data.lower_bound(x);
-    if (v==data.end())
-      return data.rbegin()->second;
-    else if (v==data.begin())
-      return v->second;
-    else if (v->first > x)
+    auto xVals=make_shared<vector<double> >(), yVals=make_shared<vector<double> >();
+    xVals->reserve(data.size()); yVals->reserve(data.size());
+    for (auto& i: data)
+      {
+        xVals->push_back(i.first);
+        yVals->push_back(i.second);
+      }
+    xData=xVals;
+    yData=yVals;
+    checkUniform();
+  }
+
+  map<double, double> DataOp::getData() const
+  {
+    auto& xVals=*xData; auto& yVals=*yData;
+    map<double, double> r;
+    for (size_t i=0; i<xVals.size(); ++i)
+      r.emplace_hint(r.end(), xVals[i], yVals[i]);
+    return r;
+  }
+
+  void DataOp::checkUniform()
+  {
+    auto& xVals=*xData;
+    cursor.store(0);
+    uniformDx=0;
+    size_t n=xVals.size();
+    if (n<3) return;
+    double dx=(xVals.back()-xVals.front())/(n-1);
+    // interval() corrects the computed index, so the tolerance only
+    // needs to ensure it is out by at most one
+    for (size_t i=0; i<n; ++i)
+      if (fabs(xVals[i]-(xVals.front()+i*dx))>0.1*dx)
+        return;
+    uniformDx=dx;
+  }
+
+  size_t DataOp::interval(double x) const
+  {
+    auto& xVals=*xData;
+    size_t last=xVals.size()-2, i;
+    if (uniformDx>0)
+      {
+        i=min(last, size_t((x-xVals.front())/uniformDx));
+        while (i>0 && xVals[i]>x) --i;
+        while (i<last && xVals[i+1]<=x) ++i;
+        return i;
+      }
+
+    // hunt outwards from the previous interval for a bracket
+    // [lo,hi] containing the interval, then bisect
+    size_t lo=min(last, cursor.load(memory_order_relaxed)), hi;
+    if (xVals[lo]<=x)
       {
-        map<double, double>::const_iterator v0=v;
-        --v0;
-        return (x-v0->first)*(v->second-v0->second)/
-          (v->first-v0->first)+v0->second;
+        if (x<xVals[lo+1]) return lo;
+        for (size_t step=1;; step*=2)
+          {
+            hi=lo+step;
+            if (hi>=last || x<xVals[hi+1])
+              {
+                hi=min(hi,last);
+                break;
+              }
+            lo=hi+1;
+          }
       }
     else
       {
-        assert(v->first==x);
-        return v->second;
+        hi=lo-1;
+        for (size_t step=1;; step*=2)
+          {
+            if (hi<step || xVals[hi-step]<=x)
+              {
+                lo=hi<step? 0: hi-step;
+                break;
+              }
+            hi-=step+1;
+          }
+      }
+    while (lo<hi)
+      {
+        size_t mid=(lo+hi+1)/2;
+        if (xVals[mid]<=x)
+          lo=mid;
+        else
+          hi=mid-1;
       }
+    cursor.store(lo, memory_order_relaxed);
+    return lo;
+  }
+
+  double DataOp::interpolate(double x) const
+  {
+    auto& xVals=*xData; auto& yVals=*yData;
+    // not terribly sensible, but need to return something
+    if (xVals.empty()) return 0;
+
+    if (x<=xVals.front())
+      return yVals.front();
+    if (x>=xVals.back())
+      return yVals.back();
+    size_t i=interval(x);
+    if (xVals[i]==x)
+      return yVals[i];
+    return (x-xVals[i])*(yVals[i+1]-yVals[i])/(xVals[i+1]-xVals[i])+yVals[i];
   }
 
   double DataOp::deriv(double x) const
   {
-    map<double, double>::const_iterator v=data.lower_bound(x);
-    if (v==data.end() || v==data.begin())
+    auto& xVals=*xData; auto& yVals=*yData;
+    if (xVals.empty() || x<=xVals.front() || x>xVals.back())
       return 0;
-    map<double, double>::const_iterator v1=v, v2=v; 
-    --v1;
-    if (v->first==x)
+    size_t i=x==xVals.back()? xVals.size()-1: interval(x);
+    if (xVals[i]==x)
       {
-        ++v2;
-        if (v2==data.end()) v2=v;
-        return (v2->second-v1->second)/(v2->first-v1->first);
+        size_t j=min(i+1, xVals.size()-1);
+        return (yVals[j]-yVals[i-1])/(xVals[j]-xVals[i-1]);
       }
     else 
-      return (v->second-v1->second)/(v->first-v1->first);
+      return (yVals[i+1]-yVals[i])/(xVals[i+1]-xVals[i]);
   }
 
   // virtual draw methods for operations - defined here rather than
@@ -704,8 +793,20 @@ namespace minsky
   {::unpack(x,d,*this);}
 
   void DataOp::pack(pack_t& x, const string& d) const
-  {::pack(x,d,*this);}
+  {
+    ::pack(x,d,*this);
+    ::pack(x,d+".xData",*xData);
+    ::pack(x,d+".yData",*yData);
+  }
       
   void DataOp::unpack(unpack_t& x, const string& d)
-  {::unpack(x,d,*this);}
+  {
+    ::unpack(x,d,*this);
+    auto xVals=make_shared<vector<double> >(), yVals=make_shared<vector<double> >();
+    ::unpack(x,d+".xData",*xVals);
+    ::unpack(x,d+".yData",*yVals);
+    xData=xVals;
+    yData=yVals;
+    checkUniform();
+  }
 }
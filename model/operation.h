@@ -29,8 +29,10 @@
 #include "item.h"
 #include "variable.h"
 #include "slider.h"
+#include "dataSet.h"
 
 #include <vector>
+#include <atomic>
 #include <cairo/cairo.h>
 
 #include <arrays.h>
@@ -207,9 +209,35 @@ namespace minsky
   class DataOp: public NamedOp, public Operation<minsky::OperationType::data>
   {
     CLASSDESC_ACCESS(DataOp);
+    /// data series, sorted by distinct x values. Shared with the
+    /// DataSet it was read from, and any other operations reading it
+    classdesc::Exclude<DataSet::Column> xData, yData;
+    /// spacing of xVals if uniform, otherwise 0
+    double uniformDx=0;
+    /// index of the interval of the last lookup, which is the
+    /// starting point for the next. Only a hint, so can be shared
+    /// between threads evaluating the same operation.
+    struct Cursor: public std::atomic<size_t>
+    {
+      Cursor(): std::atomic<size_t>(0) {}
+      Cursor(const Cursor&): std::atomic<size_t>(0) {}
+      Cursor& operator=(const Cursor&) {return *this;}
+    };
+    mutable classdesc::Exclude<Cursor> cursor;
+    /// index i of the interval xVals[i] <= x < xVals[i+1], for
+    /// xVals.front() <= x < xVals.back()
+    size_t interval(double x) const;
+    void checkUniform();
   public:
-    std::map<double, double> data;
-    void readData(const string& fileName);
+    DataOp() {xData=yData=std::make_shared<const std::vector<double> >();}
+    /// read the first data column of \a fileName (see DataSet for
+    /// the formats understood)
+    void readData(const string& fileName) {readDataColumn(fileName,1);}
+    /// read data column \a column (counting from 1) of \a fileName
+    void readDataColumn(const string& fileName, unsigned column);
+    void setData(const std::map<double, double>&);
+    std::map<double, double> getData() const;
+    size_t numPoints() const {return xData->size();}
     // interpolates y data between x values bounding the argument
     double interpolate(double) const;
     // derivative of the interpolate function. At the data points, the
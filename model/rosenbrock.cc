@@ -0,0 +1,216 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "rosenbrock.h"
+#include "minsky.h"
+#include <ecolab_epilogue.h>
+
+#include <algorithm>
+#include <math.h>
+
+using namespace std;
+
+namespace minsky
+{
+  namespace
+  {
+    /// coefficients of the formula
+    const double sqrt2=1.4142135623730951, d=1/(2+sqrt2), e32=6+sqrt2;
+  }
+
+  Rosenbrock::Rosenbrock(const Minsky& minsky, const vector<double>& flowInit):
+    minsky(minsky), flowInit(flowInit), h(minsky.stepMax)
+  {
+    auto& sj=minsky.sparseJacobian;
+    size_t n=minsky.stockVars.size();
+    if (sj.size()!=n)
+      throw error("Jacobian structure not analysed");
+    if (h<=0)
+      throw error("maximum step size must be positive");
+
+    wRowPtr.push_back(0);
+    jacPos.resize(sj.nnz());
+    diagPos.resize(n);
+    for (size_t i=0; i<n; ++i)
+      {
+        bool diag=false;
+        for (int k=sj.rowPtr[i]; k<sj.rowPtr[i+1]; ++k)
+          {
+            int j=sj.colIdx[k];
+            if (j>int(i) && !diag)
+              {
+                diagPos[i]=wColIdx.size();
+                wColIdx.push_back(i);
+                diag=true;
+              }
+            if (j==int(i))
+              {
+                diagPos[i]=wColIdx.size();
+                diag=true;
+              }
+            jacPos[k]=wColIdx.size();
+            wColIdx.push_back(j);
+          }
+        if (!diag)
+          {
+            diagPos[i]=wColIdx.size();
+            wColIdx.push_back(i);
+          }
+        wRowPtr.push_back(wColIdx.size());
+      }
+    lu.analyse(wRowPtr, wColIdx);
+
+    flow.resize(flowInit.size());
+    jac.resize(sj.nnz());
+    w.resize(wColIdx.size());
+    for (auto v: {&f0, &f1, &f2, &dfdt, &k1, &k2, &k3, &y1})
+      v->resize(n);
+    timeDependent=find(minsky.tape.opcode.begin(), minsky.tape.opcode.end(),
+                       OperationType::time) != minsky.tape.opcode.end();
+  }
+
+  void Rosenbrock::rhs(double result[], double t, const double sv[])
+  {
+    flow=flowInit;
+    minsky.evalRHS(result, t, sv, &flow[0]);
+    ++numRHS;
+  }
+
+  void Rosenbrock::computeJacobian(double t, const double sv[])
+  {
+    flow=flowInit;
+    minsky.evalSparseJacobian(jac, t, sv, &flow[0], jacScratch);
+    jacAge=0;
+    hLU=0; // factors are out of date
+    ++numJacobians;
+  }
+
+  void Rosenbrock::factorise(double h)
+  {
+    hLU=0;
+    fill(w.begin(), w.end(), 0);
+    for (size_t k=0; k<jac.size(); ++k)
+      w[jacPos[k]]=-d*h*jac[k];
+    for (int d: diagPos)
+      w[d]+=1;
+    lu.factorise(&w[0]);
+    hLU=h;
+    ++numFactorisations;
+  }
+
+  void Rosenbrock::evolve(double& t, double t1, double sv[], unsigned maxSteps)
+  {
+    const size_t n=f0.size();
+    const double hmin=minsky.stepMin, hmax=minsky.stepMax;
+    fsal=false; // sv may have been modified since the last call
+    for (unsigned steps=0; t<t1 && (maxSteps==0 || steps<maxSteps);)
+      {
+        double hs=min(h, t1-t);
+        bool last = hs>=t1-t;
+        if (jacAge<0 || jacAge>=maxJacobianAge)
+          computeJacobian(t, sv);
+        if (hs!=hLU)
+          try
+            {
+              factorise(hs);
+            }
+          catch (const std::exception&)
+            {
+              // I-dhJ is singular for this step size, so try a smaller one
+              if (hs<=hmin || hs<1e-12*max(1.0,fabs(t))) throw;
+              h=max(hmin, 0.25*hs);
+              continue;
+            }
+
+        // the derivative at the end of an accepted step is reused at
+        // the start of the next
+        if (!fsal)
+          rhs(&f0[0], t, sv);
+        // the explicit time dependence is cheap to keep up to date,
+        // whereas a stale value severely degrades accuracy
+        if (timeDependent)
+          {
+            double dt=1e-7*max(1.0,fabs(t));
+            rhs(&dfdt[0], t+dt, sv);
+            for (size_t i=0; i<n; ++i)
+              dfdt[i]=(dfdt[i]-f0[i])/dt;
+          }
+
+        // W k1 = f0 + dhT
+        for (size_t i=0; i<n; ++i)
+          k1[i]=f0[i]+(timeDependent? d*hs*dfdt[i]: 0);
+        lu.solve(&k1[0]);
+        // W (k2-k1) = f(t+h/2, y+hk1/2) - k1
+        for (size_t i=0; i<n; ++i)
+          y1[i]=sv[i]+0.5*hs*k1[i];
+        rhs(&f1[0], t+0.5*hs, &y1[0]);
+        for (size_t i=0; i<n; ++i)
+          k2[i]=f1[i]-k1[i];
+        lu.solve(&k2[0]);
+        // y' = y + hk2
+        for (size_t i=0; i<n; ++i)
+          {
+            k2[i]+=k1[i];
+            y1[i]=sv[i]+hs*k2[i];
+          }
+        // W k3 = f2 - e32(k2-f1) - 2(k1-f0) + dhT
+        rhs(&f2[0], t+hs, &y1[0]);
+        for (size_t i=0; i<n; ++i)
+          k3[i]=f2[i]-e32*(k2[i]-f1[i])-2*(k1[i]-f0[i])+
+            (timeDependent? d*hs*dfdt[i]: 0);
+        lu.solve(&k3[0]);
+
+        double err=0;
+        for (size_t i=0; i<n; ++i)
+          {
+            double e=hs/6*(k1[i]-2*k2[i]+k3[i]) /
+              (minsky.epsAbs+minsky.epsRel*max(fabs(sv[i]),fabs(y1[i])));
+            err+=e*e;
+          }
+        err=sqrt(err/n);
+
+        if (err<=1 || (hs<=hmin && isfinite(err)))
+          {
+            for (size_t i=0; i<n; ++i)
+              sv[i]=y1[i];
+            f0.swap(f2);
+            fsal=true;
+            t = last? t1: t+hs;
+            ++steps; ++numSteps; ++jacAge;
+            // a step truncated at the end point says nothing about h
+            if (last && hs<h) continue;
+            double fac = err>0? min(5.0, 0.8*pow(err,-1.0/3)): 5.0;
+            // keep the step size, and hence the factorisation, unless
+            // it can increase substantially
+            if (fac<1 || fac>1.2)
+              h=min(hmax, max(hmin, hs*fac));
+          }
+        else
+          {
+            ++numRejected;
+            if (hs<=hmin)
+              throw error("step failed at minimum step size at t=%g",t);
+            // the step may have failed due to an outdated Jacobian
+            if (jacAge>0) jacAge=maxJacobianAge;
+            h=max(hmin, hs*(isfinite(err)? max(0.2, 0.8*pow(err,-1.0/3)): 0.2));
+            if (h<1e-12*max(1.0,fabs(t)))
+              throw error("step size underflow at t=%g",t);
+          }
+      }
+  }
+}
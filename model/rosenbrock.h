@@ -0,0 +1,81 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef ROSENBROCK_H
+#define ROSENBROCK_H
+
+#include "odeSolver.h"
+#include "sparseLU.h"
+#include <vector>
+
+namespace minsky
+{
+  /**
+     Native linearly implicit solver for stiff systems, using the
+     L-stable modified Rosenbrock formula of order 2 with a third order
+     error estimate of Shampine & Reichelt (SIAM J Sci Comput 18 1,
+     1997), as used by Matlab's ode23s.
+
+     The linear systems (I-dhJ) are solved by sparse LU over the
+     Jacobian structure analysed by Minsky::reset, so the cost per
+     step scales with the number of nonzeros rather than the square of
+     the number of stocks. The formula is a W-method, ie it retains
+     its order with an approximate Jacobian, so the Jacobian is reused
+     across steps, and only refreshed after a rejected step or once it
+     is maxJacobianAge steps old. The LU factors are reused while the
+     step size is unchanged.
+  */
+  class Rosenbrock: public ODESolver
+  {
+    const Minsky& minsky;
+    const std::vector<double>& flowInit;
+    /// pattern of W=I-γhJ, being that of the Jacobian plus the diagonal
+    std::vector<int> wRowPtr, wColIdx;
+    /// position in W of each Jacobian nonzero, and of each diagonal
+    std::vector<int> jacPos, diagPos;
+    SparseLU lu;
+    /// workspace
+    std::vector<double> flow, jac, jacScratch, w, f0, f1, f2, dfdt, k1, k2, k3, y1;
+    /// whether f0 holds the derivative at the start of the step
+    bool fsal=false;
+    /// whether the equations depend explicitly on time
+    bool timeDependent;
+    double h;   ///< current step size
+    double hLU=0; ///< step size the LU factors were computed for
+    /// number of steps since the Jacobian was computed (-1 if none)
+    int jacAge=-1;
+
+    void rhs(double result[], double t, const double sv[]);
+    void computeJacobian(double t, const double sv[]);
+    void factorise(double h);
+  public:
+    /// maximum number of steps a Jacobian is reused for
+    int maxJacobianAge=20;
+
+    /// @{ statistics
+    unsigned numSteps=0, numRejected=0, numRHS=0, numJacobians=0, numFactorisations=0;
+    /// @}
+
+    /// \a minsky must have been reset, so that its Jacobian
+    /// structure is available
+    Rosenbrock(const Minsky& minsky, const std::vector<double>& flowInit);
+    void evolve(double& t, double t1, double sv[], unsigned maxSteps=0) override;
+  };
+}
+
+#endif
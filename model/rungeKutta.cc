@@ -0,0 +1,218 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "rungeKutta.h"
+#include "minsky.h"
+#include <ecolab_epilogue.h>
+
+#include <algorithm>
+#include <set>
+
+using namespace minsky;
+
+namespace
+{
+  /*
+    For using GSL Runge-Kutta routines
+  */
+
+  int RKfunction(double t, const double y[], double f[], void *params)
+  {
+    if (params==NULL) return GSL_EBADFUNC;
+    RKdata& rk=*static_cast<RKdata*>(params);
+    try
+      {
+        rk.flow=rk.flowInit;
+        rk.minsky.evalRHS(f,t,y,&rk.flow[0]);
+      }
+    catch (std::exception& e)
+      {
+        rk.errorMsg=e.what();
+        return GSL_EBADFUNC;
+      }
+    return GSL_SUCCESS;
+  }
+
+  int jacobian(double t, const double y[], double * dfdy, double dfdt[], void * params)
+  {
+   if (params==NULL) return GSL_EBADFUNC;
+   RKdata& rk=*static_cast<RKdata*>(params);
+   Minsky::Matrix jac(rk.sys.dimension, dfdy);
+   try
+     {
+       rk.flow=rk.flowInit;
+       rk.minsky.evalJacobian(jac,t,y,&rk.flow[0],rk.jacValues,rk.jacScratch);
+     }
+    catch (std::exception& e)
+     {
+       rk.errorMsg=e.what();
+       return GSL_EBADFUNC;
+     }   
+    return GSL_SUCCESS;
+  }
+
+  void errHandler(const char* reason, const char* file, int line, int gsl_errno) {
+    throw error("gsl: %s:%d: %s",file,line,reason);
+  }
+}
+
+namespace minsky
+{
+  RKdata::RKdata(const Minsky& minsky, const std::vector<double>& flowInit):
+    minsky(minsky), flowInit(flowInit)
+  {
+    gsl_set_error_handler(errHandler);
+    sys.function=RKfunction;
+    sys.jacobian=jacobian;
+    sys.dimension=minsky.stockVars.size();
+    sys.params=this;
+    const gsl_odeiv2_step_type* stepper;
+    switch (minsky.order)
+      {
+      case 1: 
+        if (!minsky.implicit)
+          throw error("First order explicit solver not available");
+        stepper=gsl_odeiv2_step_rk1imp;
+        break;
+      case 2: 
+        stepper=minsky.implicit? gsl_odeiv2_step_rk2imp: gsl_odeiv2_step_rk2;
+        break;
+      case 4:
+        stepper=minsky.implicit? gsl_odeiv2_step_rk4imp: gsl_odeiv2_step_rkf45;
+        break;
+      default:
+        throw error("order %d solver not supported",minsky.order);
+      }
+    driver = gsl_odeiv2_driver_alloc_y_new
+      (&sys, stepper, minsky.stepMax, minsky.epsAbs, 
+       minsky.epsRel);
+    gsl_odeiv2_driver_set_hmax(driver, minsky.stepMax);
+    gsl_odeiv2_driver_set_hmin(driver, minsky.stepMin);
+
+    if (minsky.locateEvents)
+      {
+        // discontinuities only feeding outputs do not affect the solution
+        std::set<const EvalOpBase*> rhsOps;
+        for (auto& o: minsky.rhsTape.ops)
+          rhsOps.insert(o.get());
+        for (size_t i: minsky.tape.discontinuities())
+          if (rhsOps.count(minsky.tape.ops[i].get()))
+            events.push_back(i);
+      }
+  }
+
+  RKdata::~RKdata() {gsl_odeiv2_driver_free(driver);}
+
+  void RKdata::evolve(double& t, double t1, double sv[], unsigned maxSteps)
+  {
+    if (!events.empty())
+      return evolveEvents(t, t1, sv, maxSteps);
+    gsl_odeiv2_driver_set_nmax(driver, maxSteps);
+    errorMsg.clear();
+    check(gsl_odeiv2_driver_apply(driver, &t, t1, sv));
+  }
+
+  void RKdata::check(int err)
+  {
+    switch (err)
+      {
+      case GSL_SUCCESS: case GSL_EMAXITER: break;
+      case GSL_FAILURE:
+        throw error("unspecified error GSL_FAILURE returned");
+      case GSL_EBADFUNC: 
+        gsl_odeiv2_driver_reset(driver);
+        if (!errorMsg.empty())
+          throw error("%s",errorMsg.c_str());
+        throw error("Invalid arithmetic operation detected");
+      default:
+        throw error("gsl error: %s",gsl_strerror(err));
+      }
+  }
+
+  void RKdata::regimesAt(std::vector<double>& r, double t, const double sv[])
+  {
+    eventFlow=flowInit;
+    minsky.tape.eval(&eventFlow[0], sv, t);
+    r.resize(events.size());
+    for (size_t k=0; k<events.size(); ++k)
+      r[k]=minsky.tape.regime(events[k], &eventFlow[0], sv);
+  }
+
+  void RKdata::evolveEvents(double& t, double t1, double sv[], unsigned maxSteps)
+  {
+    const size_t n=sys.dimension;
+    y0.resize(n); y1.resize(n); f0.resize(n); f1.resize(n);
+    regimesAt(regimes0, t, sv);
+    for (unsigned step=0; t<t1 && (maxSteps==0 || step<maxSteps); ++step)
+      {
+        double t0=t;
+        std::copy(sv, sv+n, y0.begin());
+        errorMsg.clear();
+        // step size limits, as applied by gsl_odeiv2_driver_apply
+        driver->h=std::min(std::max(driver->h, driver->hmin), driver->hmax);
+        check(gsl_odeiv2_evolve_apply(driver->e, driver->c, driver->s, &sys,
+                                      &t, t1, &driver->h, sv));
+        regimesAt(regimes1, t, sv);
+        if (regimes1==regimes0) continue;
+
+        // bisect for the first change of regime, on the cubic Hermite
+        // interpolant of the step
+        std::copy(sv, sv+n, y1.begin());
+        check(RKfunction(t0, &y0[0], &f0[0], this));
+        check(RKfunction(t, &y1[0], &f1[0], this));
+        double h=t-t0, lo=t0, hi=t;
+        double tol=std::max(minsky.stepMin, 1e-6*h);
+        while (hi-lo>tol)
+          {
+            double mid=0.5*(lo+hi), s=(mid-t0)/h, s2=s*s, s3=s2*s;
+            for (size_t i=0; i<n; ++i)
+              sv[i]=(2*s3-3*s2+1)*y0[i]+(s3-2*s2+s)*h*f0[i]+
+                (3*s2-2*s3)*y1[i]+(s3-s2)*h*f1[i];
+            regimesAt(trialRegimes, mid, sv);
+            if (trialRegimes==regimes0)
+              lo=mid;
+            else
+              hi=mid;
+          }
+
+        if (hi<t)
+          {
+            // integrate again from the start of the step to just past
+            // the discontinuity, under the same error control
+            std::copy(y0.begin(), y0.end(), sv);
+            t=t0;
+            gsl_odeiv2_step_reset(driver->s);
+            gsl_odeiv2_evolve_reset(driver->e);
+            double hSub=hi-t0;
+            while (t<hi)
+              check(gsl_odeiv2_evolve_apply(driver->e, driver->c, driver->s, &sys,
+                                            &t, hi, &hSub, sv));
+            regimesAt(regimes0, t, sv);
+          }
+        else
+          {
+            std::copy(y1.begin(), y1.end(), sv);
+            regimes0.swap(regimes1);
+          }
+        // the solution is not smooth across the discontinuity, so
+        // the stepper restarts from here
+        gsl_odeiv2_step_reset(driver->s);
+        gsl_odeiv2_evolve_reset(driver->e);
+      }
+  }
+}
@@ -0,0 +1,71 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef RUNGEKUTTA_H
+#define RUNGEKUTTA_H
+
+#include "odeSolver.h"
+#include <gsl/gsl_errno.h>
+#include <gsl/gsl_odeiv2.h>
+#include <string>
+#include <vector>
+
+namespace minsky
+{
+  /// GSL ODE driver for the equations of a model. The model is only
+  /// read, so several of these may integrate the same model
+  /// concurrently, each from their own set of variable values.
+  struct RKdata: public ODESolver
+  {
+    gsl_odeiv2_system sys;
+    gsl_odeiv2_driver* driver;
+    const Minsky& minsky;
+    /// values the flow variables are initialised to on each evaluation
+    const std::vector<double>& flowInit;
+    /// workspace for flow variables
+    std::vector<double> flow;
+    /// workspace for Jacobian evaluation
+    std::vector<double> jacValues, jacScratch;
+    /// error message of any exception thrown during a GSL callback,
+    /// as exceptions cannot propagate through GSL
+    std::string errorMsg;
+    /// instructions of minsky.tape whose discontinuities affect the
+    /// stock derivatives, if events are located
+    std::vector<size_t> events;
+    /// workspace for event location
+    std::vector<double> regimes0, regimes1, trialRegimes, y0, y1, f0, f1, eventFlow;
+
+    RKdata(const Minsky& minsky, const std::vector<double>& flowInit);
+    ~RKdata();
+    RKdata(const RKdata&)=delete;
+    void operator=(const RKdata&)=delete;
+
+    void evolve(double& t, double t1, double sv[], unsigned maxSteps=0) override;
+
+  private:
+    /// throw an error corresponding to GSL status \a err, if any
+    void check(int err);
+    /// step individually, locating the first change of regime of
+    /// any event within each step, and restarting integration there
+    void evolveEvents(double& t, double t1, double sv[], unsigned maxSteps);
+    /// regimes \a r of events at time \a t, stock variables \a sv
+    void regimesAt(std::vector<double>& r, double t, const double sv[]);
+  };
+}
+
+#endif
@@ -0,0 +1,180 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "sharedRing.h"
+#include <ecolab.h>
+#include <ecolab_epilogue.h>
+
+#include <algorithm>
+#include <atomic>
+#include <string.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using ecolab::error;
+
+namespace minsky
+{
+  namespace
+  {
+    const char magic[]="MKYRING1";
+
+    struct Header
+    {
+      char magic[8];
+      uint64_t numColumns, capacity, dataOffset;
+      atomic<uint64_t> sequence;
+    };
+
+    atomic<uint64_t>& sequence(void* base)
+    {return static_cast<Header*>(base)->sequence;}
+
+#ifndef _WIN32
+    /// map \a size bytes of \a fd, closing it
+    void* map(int fd, size_t size, bool writable)
+    {
+      void* r=mmap(nullptr, size, writable? PROT_READ|PROT_WRITE: PROT_READ,
+                   MAP_SHARED, fd, 0);
+      close(fd);
+      return r==MAP_FAILED? nullptr: r;
+    }
+#endif
+  }
+
+  SharedRingWriter::SharedRingWriter(const string& fileName, const vector<string>& columns,
+                                     size_t capacity):
+    width(columns.size()), capacity(max(capacity, size_t(1)))
+  {
+#ifdef _WIN32
+    throw error("shared ring buffers not supported on this platform");
+#else
+    size_t namesSize=0;
+    for (auto& c: columns)
+      namesSize+=sizeof(uint64_t)+c.size();
+    // align the data to a cache line
+    size_t dataOffset=(sizeof(Header)+namesSize+63)/64*64;
+    size=dataOffset+this->capacity*width*sizeof(double);
+
+    int fd=open(fileName.c_str(), O_RDWR|O_CREAT|O_TRUNC, 0644);
+    if (fd<0 || ftruncate(fd, size)!=0)
+      {
+        if (fd>=0) close(fd);
+        throw error("unable to create %s",fileName.c_str());
+      }
+    base=map(fd, size, true);
+    if (!base)
+      throw error("unable to map %s",fileName.c_str());
+
+    auto& header=*new(base) Header;
+    memcpy(header.magic, magic, 8);
+    header.numColumns=width;
+    header.capacity=this->capacity;
+    header.dataOffset=dataOffset;
+    char* p=static_cast<char*>(base)+sizeof(Header);
+    for (auto& c: columns)
+      {
+        uint64_t n=c.size();
+        memcpy(p, &n, sizeof(n));
+        memcpy(p+sizeof(n), c.data(), n);
+        p+=sizeof(n)+n;
+      }
+    data=reinterpret_cast<double*>(static_cast<char*>(base)+dataOffset);
+    header.sequence.store(0, memory_order_release);
+#endif
+  }
+
+  SharedRingWriter::~SharedRingWriter()
+  {
+#ifndef _WIN32
+    if (base) munmap(base, size);
+#endif
+  }
+
+  void SharedRingWriter::append(const double row[])
+  {
+    auto& seq=sequence(base);
+    uint64_t s=seq.load(memory_order_relaxed), k=s/2;
+    // mark row k as being written before any of it is
+    seq.store(s+1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(data+(k%capacity)*width, row, width*sizeof(double));
+    seq.store(s+2, memory_order_release);
+  }
+
+  SharedRingReader::SharedRingReader(const string& fileName)
+  {
+#ifdef _WIN32
+    throw error("shared ring buffers not supported on this platform");
+#else
+    int fd=open(fileName.c_str(), O_RDONLY);
+    struct stat s;
+    if (fd<0 || fstat(fd, &s)!=0 || size_t(s.st_size)<sizeof(Header))
+      {
+        if (fd>=0) close(fd);
+        throw error("unable to open %s",fileName.c_str());
+      }
+    size=s.st_size;
+    base=map(fd, size, false);
+    if (!base)
+      throw error("unable to map %s",fileName.c_str());
+
+    auto& header=*static_cast<const Header*>(base);
+    if (memcmp(header.magic, magic, 8)!=0)
+      throw error("%s is not a Minsky ring buffer",fileName.c_str());
+    capacity=header.capacity;
+    const char* p=static_cast<const char*>(base)+sizeof(Header);
+    for (uint64_t c=0; c<header.numColumns; ++c)
+      {
+        uint64_t n;
+        memcpy(&n, p, sizeof(n));
+        names.emplace_back(p+sizeof(n), n);
+        p+=sizeof(n)+n;
+      }
+    data=reinterpret_cast<const double*>(static_cast<const char*>(base)+header.dataOffset);
+#endif
+  }
+
+  SharedRingReader::~SharedRingReader()
+  {
+#ifndef _WIN32
+    if (base) munmap(base, size);
+#endif
+  }
+
+  uint64_t SharedRingReader::sequence() const
+  {return minsky::sequence(base).load(memory_order_acquire)/2;}
+
+  bool SharedRingReader::read(uint64_t k, double row[]) const
+  {
+    auto& seq=minsky::sequence(base);
+    // (s+1)/2 counts rows begun, including any being written
+    uint64_t s=seq.load(memory_order_acquire);
+    if (k>=s/2 || (s+1)/2-k>capacity) return false;
+    const size_t width=names.size();
+    memcpy(row, data+(k%capacity)*width, width*sizeof(double));
+    // the row may have been overwritten while being copied
+    atomic_thread_fence(memory_order_acquire);
+    s=seq.load(memory_order_relaxed);
+    return (s+1)/2-k<=capacity;
+  }
+}
@@ -0,0 +1,102 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SHAREDRING_H
+#define SHAREDRING_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+namespace minsky
+{
+  /**
+     Output channel for live consumers of a running simulation. Rows
+     of values are written into a memory mapped file laid out as a
+     single producer ring buffer, which any number of reader
+     processes may map and tail without copying, or any involvement
+     of the simulation.
+
+     The file starts with a header: the 8 byte magic string
+     "MKYRING1", then the number of columns, the capacity in rows,
+     the offset of the row data from the start of the file, and the
+     sequence counter, all uint64. The column names follow, each as a
+     uint64 length followed by its characters. Row k (counting from
+     0) occupies slot k%capacity of the data, as float64 values.
+
+     The sequence counter works as a seqlock: it is twice the number
+     of rows written, plus one while a row is being written. The
+     writer makes it odd, issues a release fence, writes the row,
+     then stores the next even value with release semantics. A
+     reader loads the counter with acquire semantics, after which
+     the seq/2 rows before it are complete, copies row k, issues an
+     acquire fence and loads the counter again. As the writer does
+     not wait for readers, row k is overwritten by row k+capacity,
+     so the copy must be discarded if (seq+1)/2, the number of rows
+     begun, exceeded k+capacity at either load. SharedRingReader
+     does this.
+  */
+  class SharedRingWriter
+  {
+  public:
+    /// @throw ecolab::error if \a fileName cannot be created and mapped
+    SharedRingWriter(const std::string& fileName, const std::vector<std::string>& columns,
+                     size_t capacity);
+    ~SharedRingWriter();
+    SharedRingWriter(const SharedRingWriter&)=delete;
+    void operator=(const SharedRingWriter&)=delete;
+
+    size_t numColumns() const {return width;}
+    /// append \a row of numColumns() values
+    void append(const double row[]);
+
+  private:
+    void* base=nullptr;
+    size_t size=0, width, capacity;
+    double* data;
+  };
+
+  /// reads the ring written by a SharedRingWriter, possibly in
+  /// another process
+  class SharedRingReader
+  {
+  public:
+    /// @throw ecolab::error if \a fileName is not a ring buffer file
+    explicit SharedRingReader(const std::string& fileName);
+    ~SharedRingReader();
+    SharedRingReader(const SharedRingReader&)=delete;
+    void operator=(const SharedRingReader&)=delete;
+
+    const std::vector<std::string>& columns() const {return names;}
+    /// number of rows written so far
+    uint64_t sequence() const;
+    /// copy row \a k into \a row, which must hold columns().size()
+    /// values.
+    /// @return false if row \a k has not yet been written, or has
+    /// been overwritten
+    bool read(uint64_t k, double row[]) const;
+
+  private:
+    void* base=nullptr;
+    size_t size=0, capacity=0;
+    const double* data=nullptr;
+    std::vector<std::string> names;
+  };
+}
+
+#endif
@@ -0,0 +1,308 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "sweep.h"
+#include "ensemble.h"
+#include "minsky.h"
+#include "threadPool.h"
+#include <ecolab_epilogue.h>
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <set>
+
+using namespace std;
+
+namespace minsky
+{
+  namespace
+  {
+    /// location of a variable's value
+    struct Slot
+    {
+      int idx;
+      bool flow;
+      double& operator()(vector<double>& sv, vector<double>& fv) const
+      {return flow? fv[idx]: sv[idx];}
+      template <size_t N>
+      double& operator()(Ensemble<N>& e, size_t lane) const
+      {return flow? e.flow(idx,lane): e.stock(idx,lane);}
+    };
+
+    Slot slot(const Minsky& m, const string& name)
+    {
+      auto v=m.variableValues.find(name);
+      if (v==m.variableValues.end())
+        v=m.variableValues.find(VariableValue::valueId(-1,name));
+      if (v==m.variableValues.end() || v->second.idx()<0)
+        throw error("unknown variable %s",name.c_str());
+      return Slot{v->second.idx(), v->second.isFlowVar()};
+    }
+
+    /// true if \a name is folded into the equations when parameters are
+    bool isFoldable(const Minsky& m, const string& name)
+    {
+      auto v=m.variableValues.find(name);
+      if (v==m.variableValues.end())
+        v=m.variableValues.find(VariableValue::valueId(-1,name));
+      return v!=m.variableValues.end() &&
+        (v->second.type()==VariableType::parameter ||
+         v->second.type()==VariableType::constant);
+    }
+
+    /// advance \a sv from \a t to exactly \a t1 using the model's
+    /// solver settings. \a fv is used as flow variable workspace,
+    /// and \a d as derivative workspace for explicit Euler.
+    void evolve(const Minsky& m, ODESolver* solver, vector<double>& sv,
+                vector<double>& fv, vector<double>& d, double& t, double t1)
+    {
+      if (solver)
+        solver->evolve(t, t1, &sv[0]);
+      else
+        while (t<t1)
+          m.eulerStep(t, t1, &sv[0], d, &fv[0]);
+    }
+
+    /// integrate runs [\a first, \a first+N) of \a sweep in lock
+    /// step. Lanes beyond the last run repeat it, and are discarded.
+    template <size_t N>
+    void runBatch(const Minsky& m, ParameterSweep& sweep, size_t first,
+                  const vector<Slot>& paramSlots, const vector<Slot>& outputSlots)
+    {
+      size_t nRuns=min(N, sweep.numRuns()-first);
+      Ensemble<N> e(m);
+      for (size_t l=0; l<N; ++l)
+        {
+          auto params=sweep.runParameters(first+min(l,nRuns-1));
+          for (size_t i=0; i<params.size(); ++i)
+            paramSlots[i](e,l)=params[i];
+        }
+      bool rk4=m.order!=1;
+      for (size_t p=0; p<sweep.times.size(); ++p)
+        {
+          if (e.t<sweep.times[p])
+            e.evolve(sweep.times[p], m.stepMax, rk4);
+          e.evalFlows();
+          for (size_t o=0; o<outputSlots.size(); ++o)
+            for (size_t l=0; l<nRuns; ++l)
+              sweep.results[o][first+l][p]=outputSlots[o](e,l);
+        }
+    }
+
+    /// errors are highlighted on the canvas of the current model,
+    /// which is not thread safe, and meaningless for a sweep, so each
+    /// thread directs them to a detached model of its own
+    Minsky& detachedModel()
+    {
+      thread_local Minsky detached;
+      return detached;
+    }
+
+    /// values of \a output over successful runs at \a point
+    vector<double> samplesAt(const vector<vector<double> >& runs,
+                             const vector<string>& errors, size_t point)
+    {
+      vector<double> r;
+      for (size_t i=0; i<runs.size(); ++i)
+        if (errors[i].empty() && point<runs[i].size())
+          r.push_back(runs[i][point]);
+      return r;
+    }
+  }
+
+  void ParameterSweep::addGrid(const string& valueId, double from, double to, unsigned n)
+  {
+    SweepParameter p;
+    p.valueId=valueId;
+    for (unsigned i=0; i<n; ++i)
+      p.values.push_back(n>1? from+i*(to-from)/(n-1): from);
+    p.min=from; p.max=to;
+    parameters.push_back(p);
+  }
+
+  void ParameterSweep::addRange(const string& valueId, double min, double max)
+  {
+    SweepParameter p;
+    p.valueId=valueId;
+    p.min=min; p.max=max;
+    parameters.push_back(p);
+  }
+
+  size_t ParameterSweep::numRuns() const
+  {
+    if (samples) return samples;
+    size_t r=1;
+    for (auto& p: parameters)
+      r*=p.values.size();
+    return r;
+  }
+
+  vector<double> ParameterSweep::runParameters(size_t run) const
+  {
+    vector<double> r(parameters.size());
+    if (samples)
+      {
+        // seed each run separately, so results do not depend on scheduling
+        seed_seq s{seed, unsigned(run), unsigned(uint64_t(run)>>32)};
+        mt19937 gen(s);
+        for (size_t i=0; i<parameters.size(); ++i)
+          {
+            auto& p=parameters[i];
+            if (p.values.empty())
+              r[i]=uniform_real_distribution<double>(p.min,p.max)(gen);
+            else
+              r[i]=p.values[uniform_int_distribution<size_t>(0,p.values.size()-1)(gen)];
+          }
+      }
+    else
+      // mixed radix decomposition of run, last parameter varying fastest
+      for (size_t i=parameters.size(); i-->0;)
+        {
+          auto& v=parameters[i].values;
+          r[i]=v[run%v.size()];
+          run/=v.size();
+        }
+    return r;
+  }
+
+  vector<double> ParameterSweep::mean(unsigned output) const
+  {
+    if (output>=results.size()) throw error("invalid output %d",output);
+    vector<double> r;
+    for (size_t p=0; p<times.size(); ++p)
+      {
+        auto x=samplesAt(results[output], errors, p);
+        double sum=0;
+        for (double y: x) sum+=y;
+        r.push_back(x.empty()? nan(""): sum/x.size());
+      }
+    return r;
+  }
+
+  vector<double> ParameterSweep::quantile(unsigned output, double q) const
+  {
+    if (output>=results.size()) throw error("invalid output %d",output);
+    if (q<0 || q>1) throw error("quantile must lie in [0,1]");
+    vector<double> r;
+    for (size_t p=0; p<times.size(); ++p)
+      {
+        auto x=samplesAt(results[output], errors, p);
+        if (x.empty())
+          {
+            r.push_back(nan(""));
+            continue;
+          }
+        // linear interpolation between order statistics
+        sort(x.begin(), x.end());
+        double pos=q*(x.size()-1);
+        size_t lo=pos;
+        double frac=pos-lo;
+        r.push_back(lo+1<x.size()? (1-frac)*x[lo]+frac*x[lo+1]: x[lo]);
+      }
+    return r;
+  }
+
+  void ParameterSweep::run(const Minsky& m)
+  {
+    // the flow variables computed by the equations cannot be set
+    set<int> computed(m.tape.out.begin(), m.tape.out.end());
+    vector<Slot> paramSlots, outputSlots;
+    for (auto& p: parameters)
+      {
+        paramSlots.push_back(slot(m, p.valueId));
+        if (paramSlots.back().flow && computed.count(paramSlots.back().idx))
+          throw error("%s is defined by an equation, so cannot be swept",
+                      p.valueId.c_str());
+        if (!m.symbolicParameters && isFoldable(m, p.valueId))
+          throw error("%s has been folded into the equations, so cannot be swept",
+                      p.valueId.c_str());
+        if (!samples && p.values.empty())
+          throw error("no values given for %s",p.valueId.c_str());
+      }
+    for (auto& o: outputs)
+      outputSlots.push_back(slot(m, o));
+
+    size_t nRuns=numRuns();
+    times.clear();
+    for (unsigned i=0; i<=numPoints; ++i)
+      times.push_back(numPoints? i*duration/numPoints: 0);
+    results.assign(outputs.size(), vector<vector<double> >
+                   (nRuns, vector<double>(times.size(), nan(""))));
+    errors.assign(nRuns, string());
+
+    auto runOne=[&](size_t run) {
+      LocalMinsky lm(detachedModel());
+      try
+        {
+          vector<double> sv(m.stockVars), fv(m.flowVars), d;
+          auto params=runParameters(run);
+          for (size_t i=0; i<params.size(); ++i)
+            paramSlots[i](sv,fv)=params[i];
+
+          auto solver=createODESolver(m, fv);
+          double t=0;
+          for (size_t p=0; p<times.size(); ++p)
+            {
+              if (t<times[p])
+                evolve(m, solver.get(), sv, fv, d, t, times[p]);
+              m.tape.eval(&fv[0], &sv[0], t);
+              for (size_t o=0; o<outputSlots.size(); ++o)
+                results[o][run][p]=outputSlots[o](sv,fv);
+            }
+        }
+      catch (const std::exception& e)
+        {
+          errors[run]=e.what();
+          for (auto& o: results)
+            fill(o[run].begin(), o[run].end(), nan(""));
+        }
+    };
+
+    unsigned nThreads=threads? threads: max(1U, thread::hardware_concurrency());
+    if (!pool || pool->size()!=nThreads)
+      pool=make_shared<ThreadPool>(nThreads);
+    switch (lanes)
+      {
+      case 0: case 1:
+        pool->parallelFor(nRuns, runOne);
+        break;
+      case 4: case 8:
+        pool->parallelFor((nRuns+lanes-1)/lanes, [&](size_t batch) {
+            size_t first=batch*lanes;
+            try
+              {
+                LocalMinsky lm(detachedModel());
+                if (lanes==4)
+                  runBatch<4>(m, *this, first, paramSlots, outputSlots);
+                else
+                  runBatch<8>(m, *this, first, paramSlots, outputSlots);
+              }
+            catch (const std::exception&)
+              {
+                // rerun individually to attribute the error
+                for (size_t r=first; r<min(first+lanes, nRuns); ++r)
+                  runOne(r);
+              }
+          });
+        break;
+      default:
+        throw error("lanes must be 1, 4 or 8");
+      }
+  }
+}
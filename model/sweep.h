@@ -0,0 +1,113 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include "classdesc_access.h"
+#include <pack_base.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace minsky
+{
+  class Minsky;
+  class ThreadPool;
+
+  /// a variable varied by a parameter sweep
+  struct SweepParameter
+  {
+    std::string valueId;
+    /// values taken in a grid sweep. In a sampled sweep, if
+    /// nonempty, values are drawn uniformly from this list
+    std::vector<double> values;
+    /// range sampled uniformly in a sampled sweep, if values is empty
+    double min=0, max=0;
+  };
+
+  /**
+     Runs many independent simulations of a model, varying parameters
+     and initial conditions of stock variables, recording selected
+     outputs of each run at regular intervals. The equations of the
+     model are shared, read only, between the runs, which are
+     distributed across a pool of threads.
+  */
+  class ParameterSweep
+  {
+    CLASSDESC_ACCESS(ParameterSweep);
+  public:
+    std::vector<SweepParameter> parameters;
+    /// valueIds of the variables recorded
+    std::vector<std::string> outputs;
+    /// number of randomly sampled runs. If zero, the Cartesian
+    /// product of all parameter values is run.
+    unsigned samples=0;
+    unsigned seed=0; ///< random number seed for sampled sweeps
+    double duration=1; ///< simulation time of each run
+    unsigned numPoints=100; ///< number of intervals recorded per run
+    unsigned threads=0; ///< number of threads to use (0=number of cores)
+    /// number of runs integrated in lock step by each thread (1, 4 or
+    /// 8). If greater than 1, runs use a fixed step size of
+    /// Minsky::stepMax, with RK4, or explicit Euler if Minsky::order
+    /// is 1. A batch of runs that fails is rerun one at a time, so
+    /// errors are reported against the individual runs.
+    unsigned lanes=1;
+
+    /// @{ convenience methods for setting up a sweep
+    void clear() {parameters.clear(); outputs.clear();}
+    /// add a parameter taking \a n evenly spaced values in [\a from, \a to]
+    void addGrid(const std::string& valueId, double from, double to, unsigned n);
+    /// add a parameter sampled uniformly from [\a min, \a max]
+    void addRange(const std::string& valueId, double min, double max);
+    void addOutput(const std::string& valueId) {outputs.push_back(valueId);}
+    /// @}
+
+    /// number of runs implied by the current specification
+    size_t numRuns() const;
+    /// parameter values of run \a run, in order of parameters
+    std::vector<double> runParameters(size_t run) const;
+
+    /// @{ results of the last sweep
+    std::vector<double> times; ///< time of each recorded point
+    /// results[output][run][point]. Failed runs are filled with NaN
+    std::vector<std::vector<std::vector<double> > > results;
+    /// error message of each failed run, empty for successful runs
+    std::vector<std::string> errors;
+    /// @}
+
+    /// mean of \a output across successful runs, at each recorded point
+    std::vector<double> mean(unsigned output) const;
+    /// \a q quantile (0<=q<=1) of \a output across successful runs, at
+    /// each recorded point. Together with mean, provides bands for
+    /// plotting.
+    std::vector<double> quantile(unsigned output, double q) const;
+
+    /// perform the sweep, starting each run from the current state
+    /// of \a model, which must have had its equations constructed
+    /// @throw ecolab::error if parameters or outputs are invalid
+    void run(const Minsky& model);
+
+  private:
+    /// worker threads, kept between sweeps while threads is unchanged
+    classdesc::Exclude<std::shared_ptr<ThreadPool> > pool;
+  };
+}
+
+#include "sweep.cd"
+#endif
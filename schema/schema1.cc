@@ -109,7 +109,7 @@ namespace schema1
         c->value=y.value;
       if (auto d=dynamic_cast<minsky::DataOp*>(&x))
         {
-          d->data=y.data;
+          d->setData(y.data);
           d->description=y.name;
         }
     }
@@ -225,7 +225,7 @@ namespace schema1
     else if (const minsky::DataOp* d=dynamic_cast<const minsky::DataOp*>(&op))
       {
         name=d->description;
-        data=d->data;
+        data=d->getData();
       }
   }
 
@@ -343,7 +343,7 @@ namespace schema1
         auto o=imap.addItem(minsky::OperationBase::create(i.type), i);
         combine.combine(*o,i);
         if (auto d=dynamic_cast<minsky::DataOp*>(o))
-          d->data=i.data;
+          d->setData(i.data);
         else if (auto integ=dynamic_cast<minsky::IntOp*>(o))
           {
             // this ensures that the output port refers to this item,
@@ -0,0 +1,116 @@
+/*
+  @copyright Steve Keen 2017
+  @author Russell Standish
+  This file is part of Minsky.
+
+  Minsky is free software: you can redistribute it and/or modify it
+  under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+
+  Minsky is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include "allocationCounter.h"
+
+#include <algorithm>
+#include <new>
+#include <stdlib.h>
+
+// Replacing the global allocation functions affects the whole
+// program, so this file is only linked into the unit tests. All the
+// replaceable forms are replaced, so that every allocation is counted,
+// and memory is always released by the matching function.
+namespace
+{
+  thread_local size_t numAllocations=0;
+
+  void* allocate(size_t n)
+  {
+    ++numAllocations;
+    if (void* p=malloc(n? n: 1))
+      return p;
+    throw std::bad_alloc();
+  }
+
+#ifdef __cpp_aligned_new
+  void* allocate(size_t n, std::align_val_t a)
+  {
+    ++numAllocations;
+    size_t align=std::max(size_t(a), sizeof(void*));
+#ifdef _WIN32
+    if (void* p=_aligned_malloc(n? n: 1, align))
+      return p;
+#else
+    void* p;
+    if (posix_memalign(&p, align, n? n: 1)==0)
+      return p;
+#endif
+    throw std::bad_alloc();
+  }
+
+  void deallocateAligned(void* p)
+  {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+  }
+#endif
+}
+
+void* operator new(size_t n) {return allocate(n);}
+void* operator new[](size_t n) {return allocate(n);}
+void* operator new(size_t n, const std::nothrow_t&) noexcept
+{
+  try {return allocate(n);}
+  catch (...) {return nullptr;}
+}
+void* operator new[](size_t n, const std::nothrow_t&) noexcept
+{
+  try {return allocate(n);}
+  catch (...) {return nullptr;}
+}
+
+void operator delete(void* p) noexcept {free(p);}
+void operator delete[](void* p) noexcept {free(p);}
+void operator delete(void* p, const std::nothrow_t&) noexcept {free(p);}
+void operator delete[](void* p, const std::nothrow_t&) noexcept {free(p);}
+#ifdef __cpp_sized_deallocation
+void operator delete(void* p, size_t) noexcept {free(p);}
+void operator delete[](void* p, size_t) noexcept {free(p);}
+#endif
+
+#ifdef __cpp_aligned_new
+void* operator new(size_t n, std::align_val_t a) {return allocate(n,a);}
+void* operator new[](size_t n, std::align_val_t a) {return allocate(n,a);}
+void* operator new(size_t n, std::align_val_t a, const std::nothrow_t&) noexcept
+{
+  try {return allocate(n,a);}
+  catch (...) {return nullptr;}
+}
+void* operator new[](size_t n, std::align_val_t a, const std::nothrow_t&) noexcept
+{
+  try {return allocate(n,a);}
+  catch (...) {return nullptr;}
+}
+void operator delete(void* p, std::align_val_t) noexcept {deallocateAligned(p);}
+void operator delete[](void* p, std::align_val_t) noexcept {deallocateAligned(p);}
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{deallocateAligned(p);}
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept
+{deallocateAligned(p);}
+void operator delete(void* p, size_t, std::align_val_t) noexcept {deallocateAligned(p);}
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {deallocateAligned(p);}
+#endif
+
+namespace minsky
+{
+  size_t allocationCount() {return numAllocations;}
+}
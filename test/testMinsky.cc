@@ -17,6 +17,9 @@
   along with Minsky.  If not, see <http://www.gnu.org/licenses/>.
 */
 #include "minsky.h"
+#include "explicitRK.h"
+#include "rosenbrock.h"
+#include "allocationCounter.h"
 #include <ecolab_epilogue.h>
 #include <UnitTest++/UnitTest++.h>
 #include <gsl/gsl_integration.h>
@@ -218,7 +221,44 @@ SUITE(Minsky)
       CHECK_EQUAL(-5,variableValues[":d"].value());
       CHECK_EQUAL(0,variableValues[":e"].value());
       CHECK_EQUAL(5,variableValues[":a"].value());
-    
+
+    }
+
+  TEST_FIXTURE(TestFixture,godleyCSR)
+    {
+      auto gi=new GodleyIcon;
+      model->addItem(gi);
+      GodleyTable& godley=gi->table;
+      godley.resize(4,3);
+      godley.cell(0,1)=":c";
+      godley.cell(0,2)=":d";
+      godley.cell(1,0)="initial conditions";
+      godley.cell(2,1)=":a";
+      godley.cell(2,2)="-:a";
+      godley.cell(3,1)="2:b";
+      godley.cell(3,2)=":b";
+      gi->update();
+
+      variableValues[":a"].init="5";
+      variableValues[":b"].init="3";
+
+      garbageCollect();
+      reset();
+
+      // each stock's entries are contiguous
+      CHECK_EQUAL(2, evalGodley.numRows());
+      CHECK_EQUAL(evalGodley.stockIdx().size(), evalGodley.rowStart()[2]);
+      for (size_t r=0; r<evalGodley.numRows(); ++r)
+        for (int k=evalGodley.rowStart()[r]; k<evalGodley.rowStart()[r+1]; ++k)
+          CHECK_EQUAL(evalGodley.rowStock()[r], evalGodley.stockIdx()[k]);
+
+      // rows are assigned, rather than accumulated
+      for (int i=0; i<2; ++i)
+        {
+          evalGodley.eval(&stockVars[0], &flowVars[0]);
+          CHECK_EQUAL(11,variableValues[":c"].value());
+          CHECK_EQUAL(-2,variableValues[":d"].value());
+        }
     }
 
   /*
@@ -299,6 +339,345 @@ SUITE(Minsky)
       CHECK_EQUAL(1,jac(3,1));
       CHECK_EQUAL(0,jac(3,2));
       CHECK_EQUAL(0,jac(3,3));
+
+      // every nonzero lies in the analysed structure, and columns of
+      // the same colour share no row
+      CHECK_EQUAL(stockVars.size(), sparseJacobian.size());
+      for (size_t i=0; i<stockVars.size(); ++i)
+        {
+          set<int> cols(sparseJacobian.colIdx.begin()+sparseJacobian.rowPtr[i],
+                        sparseJacobian.colIdx.begin()+sparseJacobian.rowPtr[i+1]);
+          set<int> colours;
+          for (int j: cols)
+            CHECK(colours.insert(sparseJacobian.colour[j]).second);
+          for (size_t j=0; j<stockVars.size(); ++j)
+            if (jac(i,j)!=0)
+              CHECK(cols.count(j));
+        }
+    }
+
+  TEST_FIXTURE(TestFixture,deadOpElimination)
+    {
+      // x'=-x, with y=exp(sin(x)) only computed for output
+      auto k=model->addItem(VariablePtr(VariableType::parameter,"k"));
+      auto i=model->addItem(OperationPtr(OperationType::integrate));
+      auto m=model->addItem(OperationPtr(OperationType::multiply));
+      auto s=model->addItem(OperationPtr(OperationType::sin));
+      auto e=model->addItem(OperationPtr(OperationType::exp));
+      auto y=model->addItem(VariablePtr(VariableType::flow,"y"));
+      dynamic_cast<IntOp&>(*i).description("x");
+      dynamic_cast<IntOp&>(*i).intVar->init("1");
+      model->addWire(*k, *m, 1);
+      model->addWire(*i, *m, 2);
+      model->addWire(*m, *i, 1);
+      model->addWire(*i, *s, 1);
+      model->addWire(*s, *e, 1);
+      model->addWire(*e, *y, 1);
+      variableValues[":k"].init="-1";
+      reset();
+
+      CHECK(rhsTape.size()+2 <= tape.size());
+      for (auto op: rhsTape.opcode)
+        CHECK(op!=OperationType::sin && op!=OperationType::exp);
+
+      // output variables are still updated
+      step();
+      CHECK_CLOSE(std::exp(std::sin(variableValues[":x"].value())),
+                  variableValues[":y"].value(), 1e-10);
+    }
+
+  TEST_FIXTURE(TestFixture,structuralCSE)
+    {
+      // y1=sin(k*x), y2=sin(x*k), as if copy/pasted, with arguments
+      // wired in opposite order
+      auto k=model->addItem(VariablePtr(VariableType::parameter,"k"));
+      auto x=model->addItem(VariablePtr(VariableType::parameter,"x"));
+      vector<ItemPtr> sins;
+      for (int n=0; n<2; ++n)
+        {
+          auto m=model->addItem(OperationPtr(OperationType::multiply));
+          auto s=model->addItem(OperationPtr(OperationType::sin));
+          auto y=model->addItem(VariablePtr(VariableType::flow,"y"+to_string(n+1)));
+          model->addWire(*k, *m, n? 2: 1);
+          model->addWire(*x, *m, n? 1: 2);
+          model->addWire(*m, *s, 1);
+          model->addWire(*s, *y, 1);
+          sins.push_back(s);
+        }
+      variableValues[":k"].init="2";
+      variableValues[":x"].init="0.3";
+      reset();
+
+      CHECK_EQUAL(2, mergedSubexpressions);
+      size_t numSin=0;
+      for (auto op: tape.opcode)
+        if (op==OperationType::sin) numSin++;
+      CHECK_EQUAL(1, numSin);
+
+      CHECK_CLOSE(sin(0.6), variableValues[":y1"].value(), 1e-10);
+      CHECK_CLOSE(sin(0.6), variableValues[":y2"].value(), 1e-10);
+      // both icons display the shared result
+      for (auto& s: sins)
+        CHECK_CLOSE(sin(0.6), s->ports[0]->getVariableValue().value(), 1e-10);
+    }
+
+  TEST_FIXTURE(TestFixture,simplifyEquations)
+    {
+      // y=x*1+0, z=sin(2*3)
+      auto x=model->addItem(VariablePtr(VariableType::parameter,"x"));
+      vector<ItemPtr> c;
+      for (double v: {1,0,2,3})
+        {
+          c.push_back(model->addItem(OperationPtr(OperationType::constant)));
+          dynamic_cast<Constant&>(*c.back()).value=v;
+        }
+      auto m1=model->addItem(OperationPtr(OperationType::multiply));
+      auto a=model->addItem(OperationPtr(OperationType::add));
+      auto y=model->addItem(VariablePtr(VariableType::flow,"y"));
+      model->addWire(*x, *m1, 1);
+      model->addWire(*c[0], *m1, 2);
+      model->addWire(*m1, *a, 1);
+      model->addWire(*c[1], *a, 2);
+      model->addWire(*a, *y, 1);
+      auto m2=model->addItem(OperationPtr(OperationType::multiply));
+      auto s=model->addItem(OperationPtr(OperationType::sin));
+      auto z=model->addItem(VariablePtr(VariableType::flow,"z"));
+      model->addWire(*c[2], *m2, 1);
+      model->addWire(*c[3], *m2, 2);
+      model->addWire(*m2, *s, 1);
+      model->addWire(*s, *z, 1);
+      variableValues[":x"].init="0.5";
+      reset();
+
+      for (auto op: tape.opcode)
+        CHECK(op==OperationType::copy);
+      CHECK_EQUAL(0.5, variableValues[":y"].value());
+      CHECK_CLOSE(sin(6), variableValues[":z"].value(), 1e-10);
+      // icons simplified away still display their values
+      CHECK_EQUAL(0.5, m1->ports[0]->value());
+      CHECK_EQUAL(6, m2->ports[0]->value());
+      CHECK_EQUAL(3, c[3]->ports[0]->value());
+
+      // parameters are only folded on request
+      auto s2=model->addItem(OperationPtr(OperationType::sin));
+      auto w=model->addItem(VariablePtr(VariableType::flow,"w"));
+      model->addWire(*x, *s2, 1);
+      model->addWire(*s2, *w, 1);
+      reset();
+      size_t numSin=0;
+      for (auto op: tape.opcode)
+        if (op==OperationType::sin) numSin++;
+      CHECK_EQUAL(1, numSin);
+
+      symbolicParameters=false;
+      reset();
+      for (auto op: tape.opcode)
+        CHECK(op==OperationType::copy);
+      CHECK_CLOSE(sin(0.5), variableValues[":w"].value(), 1e-10);
+
+      // folded parameters cannot be swept
+      parameterSweep.clear();
+      parameterSweep.addGrid(":x", 0, 1, 2);
+      parameterSweep.addOutput(":w");
+      CHECK_THROW(parameterSweep.run(*this), ecolab::error);
+
+      // nor can constant variables, which are otherwise left for
+      // their sliders to alter
+      auto cv=model->addItem(VariablePtr(VariableType::constant,"0.25"));
+      auto s3=model->addItem(OperationPtr(OperationType::sin));
+      auto u=model->addItem(VariablePtr(VariableType::flow,"u"));
+      model->addWire(*cv, *s3, 1);
+      model->addWire(*s3, *u, 1);
+      symbolicParameters=true;
+      reset();
+      CHECK_CLOSE(sin(0.25), variableValues[":u"].value(), 1e-10);
+      dynamic_cast<VariableBase&>(*cv).sliderSet(0.75);
+      tape.eval(&flowVars[0], &stockVars[0], t);
+      CHECK_CLOSE(sin(0.75), variableValues[":u"].value(), 1e-10);
+
+      symbolicParameters=false;
+      reset();
+      parameterSweep.clear();
+      parameterSweep.addGrid(dynamic_cast<VariableBase&>(*cv).valueId(), 0, 1, 2);
+      parameterSweep.addOutput(":u");
+      CHECK_THROW(parameterSweep.run(*this), ecolab::error);
+    }
+
+  TEST_FIXTURE(TestFixture,slotAllocation)
+    {
+      // x'=c, c=sin(b), b=a, a=k*x
+      auto k=model->addItem(VariablePtr(VariableType::parameter,"k"));
+      auto i=model->addItem(OperationPtr(OperationType::integrate));
+      auto m=model->addItem(OperationPtr(OperationType::multiply));
+      auto a=model->addItem(VariablePtr(VariableType::flow,"a"));
+      auto b=model->addItem(VariablePtr(VariableType::flow,"b"));
+      auto s=model->addItem(OperationPtr(OperationType::sin));
+      auto c=model->addItem(VariablePtr(VariableType::flow,"c"));
+      dynamic_cast<IntOp&>(*i).description("x");
+      dynamic_cast<IntOp&>(*i).intVar->init("1");
+      model->addWire(*k, *m, 1);
+      model->addWire(*i, *m, 2);
+      model->addWire(*m, *a, 1);
+      model->addWire(*a, *b, 1);
+      model->addWire(*b, *s, 1);
+      model->addWire(*s, *c, 1);
+      model->addWire(*c, *i, 1);
+      variableValues[":k"].init="-0.5";
+      reset();
+
+      auto count=[](const EvalTape& t, OperationType::Type op) {
+        return std::count(t.opcode.begin(), t.opcode.end(), op);
+      };
+      CHECK(count(rhsTape, OperationType::copy) < count(tape, OperationType::copy));
+      CHECK(set<int>(rhsTape.out.begin(), rhsTape.out.end()).size() <
+            set<int>(tape.out.begin(), tape.out.end()).size());
+
+      // the integral input is computed identically
+      vector<double> f1(flowVars), f2(flowVars);
+      tape.eval(&f1[0], &stockVars[0], 0);
+      rhsTape.eval(&f2[0], &stockVars[0], 0);
+      CHECK_EQUAL(1, integrals.size());
+      CHECK(integrals[0].input.isFlowVar());
+      CHECK_EQUAL(sin(-0.5), f2[integrals[0].input.idx()]);
+      CHECK_EQUAL(f1[integrals[0].input.idx()], f2[integrals[0].input.idx()]);
+
+      // displayed values are unaffected
+      step();
+      double x=variableValues[":x"].value();
+      CHECK_CLOSE(-0.5*x, variableValues[":a"].value(), 1e-10);
+      CHECK_CLOSE(-0.5*x, variableValues[":b"].value(), 1e-10);
+      CHECK_CLOSE(sin(-0.5*x), variableValues[":c"].value(), 1e-10);
+    }
+
+  TEST_FIXTURE(TestFixture,renumberVariables)
+    {
+      // chain of integrals x_a'=x_b, coupled in an order unrelated to
+      // their order of creation
+      vector<ItemPtr> ints;
+      for (int n=0; n<5; ++n)
+        ints.push_back(model->addItem(OperationPtr(OperationType::integrate)));
+      int order[]={0,3,1,4,2};
+      for (int n=0; n<4; ++n)
+        model->addWire(*ints[order[n+1]], *ints[order[n]], 1);
+      auto k=model->addItem(VariablePtr(VariableType::parameter,"k"));
+      model->addWire(*k, *ints[order[4]], 1);
+      variableValues[":k"].init="2";
+      reset();
+
+      // stocks are ordered so the Jacobian is tridiagonal
+      CHECK_EQUAL(5, sparseJacobian.size());
+      for (size_t i=0; i<sparseJacobian.size(); ++i)
+        for (int p=sparseJacobian.rowPtr[i]; p<sparseJacobian.rowPtr[i+1]; ++p)
+          CHECK(std::abs(int(i)-sparseJacobian.colIdx[p])<=1);
+
+      // flow variables are numbered in order of first access
+      int next=0;
+      set<int> seen;
+      auto access=[&](int i) {
+        if (seen.insert(i).second) CHECK_EQUAL(next++, i);
+      };
+      for (size_t i=0; i<tape.size(); ++i)
+        {
+          int nArgs=tape.ops[i]->numArgs();
+          if (nArgs>0 && (tape.flags[i]&EvalTape::flow1)) access(tape.in1[i]);
+          if (nArgs>1 && (tape.flags[i]&EvalTape::flow2)) access(tape.in2[i]);
+          access(tape.out[i]);
+        }
+
+      // references to the variables are consistent
+      for (auto& i: integrals)
+        {
+          CHECK_EQUAL(variableValues[i.operation->intVar->valueId()].idx(), i.stock.idx());
+          if (i.operation==ints[order[4]].get())
+            CHECK_EQUAL(2, i.input.value());
+        }
+      CHECK_EQUAL(2, k->ports[0]->getVariableValue().value());
+    }
+
+  TEST_FIXTURE(TestFixture,sparseJacobian)
+    {
+      // three uncoupled decays x'=-kx, so the Jacobian is diagonal,
+      // and a single directional derivative suffices
+      auto k=model->addItem(VariablePtr(VariableType::parameter,"k"));
+      for (int n=0; n<3; ++n)
+        {
+          auto i=model->addItem(OperationPtr(OperationType::integrate));
+          auto m=model->addItem(OperationPtr(OperationType::multiply));
+          model->addWire(*k, *m, 1);
+          model->addWire(*i, *m, 2);
+          model->addWire(*m, *i, 1);
+        }
+      variableValues[":k"].init="-2";
+      reset();
+      CHECK_EQUAL(3, stockVars.size());
+      CHECK_EQUAL(3, sparseJacobian.nnz());
+      CHECK_EQUAL(1, sparseJacobian.numColours());
+
+      vector<double> values, scratch, flow(flowVars);
+      evalSparseJacobian(values, 0, &stockVars[0], &flow[0], scratch);
+      CHECK_EQUAL(3, values.size());
+      for (size_t i=0; i<3; ++i)
+        {
+          CHECK_EQUAL(i, sparseJacobian.colIdx[sparseJacobian.rowPtr[i]]);
+          CHECK_EQUAL(-2, values[i]);
+        }
+
+      vector<double> j(9);
+      Matrix jac(3,&j[0]);
+      jacobian(jac, 0, &stockVars[0]);
+      for (size_t r=0; r<3; ++r)
+        for (size_t c=0; c<3; ++c)
+          CHECK_EQUAL(r==c? -2: 0, jac(r,c));
+    }
+
+  TEST_FIXTURE(TestFixture,nonlinearJacobian)
+    {
+      // x'=exp(sin(k x)), y'=x y, where intermediate values share
+      // slots in the tape used to compute the right hand side
+      auto k=model->addItem(VariablePtr(VariableType::parameter,"k"));
+      auto ix=model->addItem(OperationPtr(OperationType::integrate));
+      auto iy=model->addItem(OperationPtr(OperationType::integrate));
+      auto m=model->addItem(OperationPtr(OperationType::multiply));
+      auto s=model->addItem(OperationPtr(OperationType::sin));
+      auto e=model->addItem(OperationPtr(OperationType::exp));
+      auto m2=model->addItem(OperationPtr(OperationType::multiply));
+      dynamic_cast<IntOp&>(*ix).description("x");
+      dynamic_cast<IntOp&>(*ix).intVar->init("0.3");
+      dynamic_cast<IntOp&>(*iy).description("y");
+      dynamic_cast<IntOp&>(*iy).intVar->init("1.2");
+      model->addWire(*k, *m, 1);
+      model->addWire(*ix, *m, 2);
+      model->addWire(*m, *s, 1);
+      model->addWire(*s, *e, 1);
+      model->addWire(*e, *ix, 1);
+      model->addWire(*ix, *m2, 1);
+      model->addWire(*iy, *m2, 2);
+      model->addWire(*m2, *iy, 1);
+      variableValues[":k"].init="0.7";
+      reset();
+      CHECK_EQUAL(2, stockVars.size());
+
+      // central differences of the right hand side
+      const size_t n=stockVars.size();
+      const double h=1e-6;
+      vector<double> fd(n*n), sv(stockVars), rp(n), rm(n), flow(flowVars);
+      for (size_t c=0; c<n; ++c)
+        {
+          sv[c]=stockVars[c]+h;
+          evalRHS(&rp[0], 0, &sv[0], &flow[0]);
+          sv[c]=stockVars[c]-h;
+          evalRHS(&rm[0], 0, &sv[0], &flow[0]);
+          sv[c]=stockVars[c];
+          for (size_t r=0; r<n; ++r)
+            fd[r*n+c]=(rp[r]-rm[r])/(2*h);
+        }
+
+      vector<double> j(n*n);
+      Matrix jac(n,&j[0]);
+      jacobian(jac, 0, &stockVars[0]);
+      for (size_t r=0; r<n; ++r)
+        for (size_t c=0; c<n; ++c)
+          CHECK_CLOSE(fd[r*n+c], jac(r,c), 1e-6);
     }
 
   TEST_FIXTURE(TestFixture,integrals)
@@ -334,6 +713,781 @@ SUITE(Minsky)
       CHECK_CLOSE(0.5*value*t*t, intOp->intVar->value(), 1e-5);
     }
 
+  // check that the flattened tape gives the same results as the EvalOps it was built from
+  TEST_FIXTURE(TestFixture,evalTape)
+    {
+      auto time=model->addItem(OperationPtr(OperationType::time));
+      auto s=model->addItem(OperationPtr(OperationType::sin));
+      auto c=model->addItem(OperationPtr(OperationType::constant));
+      auto m=model->addItem(OperationPtr(OperationType::multiply));
+      auto i=model->addItem(OperationPtr(OperationType::integrate));
+      auto ex=model->addItem(OperationPtr(OperationType::exp));
+      auto y=model->addItem(VariablePtr(VariableType::flow,"y"));
+      auto z=model->addItem(VariablePtr(VariableType::flow,"z"));
+      dynamic_cast<Constant&>(*c).value=2;
+      model->addWire(*time, *s, 1);
+      model->addWire(*s, *m, 1);
+      model->addWire(*c, *m, 2);
+      model->addWire(*i, *m, 2);
+      model->addWire(*m, *y, 1);
+      model->addWire(*y, *i, 1);
+      model->addWire(*i, *ex, 1);
+      model->addWire(*ex, *z, 1);
+      reset();
+
+      CHECK_EQUAL(equations.size(), tape.size());
+      for (auto& x: stockVars) x=0.3;
+      t=0.7;
+
+      vector<double> f1(flowVars), f2(flowVars);
+      for (auto& eq: equations)
+        eq->eval(&f1[0], &stockVars[0], t);
+      tape.eval(&f2[0], &stockVars[0], t);
+      CHECK_ARRAY_CLOSE(f1, f2, f1.size(), 1e-10);
+      CHECK_CLOSE(2*0.3*sin(0.7), f2[variableValues[":y"].idx()], 1e-10);
+
+      for (size_t j=0; j<stockVars.size(); ++j)
+        {
+          vector<double> ds(stockVars.size()), df1(flowVars.size()), df2(flowVars.size());
+          ds[j]=1;
+          for (auto& eq: equations)
+            eq->deriv(&df1[0], &ds[0], &stockVars[0], &f1[0]);
+          tape.deriv(&df2[0], &ds[0], &stockVars[0], &f2[0]);
+          CHECK_ARRAY_CLOSE(df1, df2, df1.size(), 1e-10);
+        }
+    }
+
+  // check that level scheduled parallel evaluation matches serial evaluation
+  TEST_FIXTURE(TestFixture,parallelEvaluation)
+    {
+      // x'=k x + sin x, many times over
+      auto k=model->addItem(VariablePtr(VariableType::parameter,"k"));
+      for (int n=0; n<16; ++n)
+        {
+          auto i=model->addItem(OperationPtr(OperationType::integrate));
+          auto m=model->addItem(OperationPtr(OperationType::multiply));
+          auto s=model->addItem(OperationPtr(OperationType::sin));
+          auto a=model->addItem(OperationPtr(OperationType::add));
+          model->addWire(*k, *m, 1);
+          model->addWire(*i, *m, 2);
+          model->addWire(*i, *s, 1);
+          model->addWire(*m, *a, 1);
+          model->addWire(*s, *a, 2);
+          model->addWire(*a, *i, 1);
+        }
+      variableValues[":k"].init="-2";
+
+      auto evaluate=[&](vector<double>& result, vector<double>& jac) {
+        for (size_t i=0; i<stockVars.size(); ++i) stockVars[i]=0.1*i;
+        result.resize(stockVars.size());
+        evalEquations(&result[0], 0, &stockVars[0]);
+        vector<double> flow(flowVars), scratch;
+        evalSparseJacobian(jac, 0, &stockVars[0], &flow[0], scratch);
+      };
+
+      reset();
+      CHECK(rhsTape.levels().empty());
+      vector<double> r1, j1, r2, j2;
+      evaluate(r1, j1);
+
+      evalThreads=4;
+      reset();
+      // distribute even the smallest levels
+      rhsTape.schedule(rhsTape.threadPool(), 1);
+      auto& levels=rhsTape.levels();
+      CHECK(levels.size()>2);
+      CHECK_EQUAL(rhsTape.size(), levels.back());
+      // no instruction writes an operand of another in its level
+      for (size_t l=0; l+1<levels.size(); ++l)
+        for (size_t i=levels[l]; i<levels[l+1]; ++i)
+          for (size_t j=levels[l]; j<levels[l+1]; ++j)
+            if (rhsTape.ops[i]->numArgs()>0 && (rhsTape.flags[i]&EvalTape::flow1))
+              CHECK(rhsTape.out[j]!=rhsTape.in1[i] || j==i);
+
+      evaluate(r2, j2);
+      CHECK_ARRAY_EQUAL(r1, r2, r1.size());
+      CHECK_EQUAL(j1.size(), j2.size());
+      CHECK_ARRAY_EQUAL(j1, j2, j1.size());
+    }
+
+  // check that deferred checking reports errors as checking every operation does
+  TEST_FIXTURE(TestFixture,deferredFiniteChecks)
+    {
+      // x'=sqrt(k x)
+      auto k=model->addItem(VariablePtr(VariableType::parameter,"k"));
+      auto i=model->addItem(OperationPtr(OperationType::integrate));
+      auto m=model->addItem(OperationPtr(OperationType::multiply));
+      auto s=model->addItem(OperationPtr(OperationType::sqrt));
+      model->addWire(*k, *m, 1);
+      model->addWire(*i, *m, 2);
+      model->addWire(*m, *s, 1);
+      model->addWire(*s, *i, 1);
+      variableValues[":k"].init="2";
+
+      auto evaluate=[&](double x, vector<double>& df)->string {
+        vector<double> fv(flowVars), ds(stockVars.size(), 1);
+        vector<double> sv(stockVars.size(), x);
+        df.assign(flowVars.size(), 0);
+        try
+          {
+            rhsTape.eval(&fv[0], &sv[0], 0);
+            rhsTape.deriv(&df[0], &ds[0], &sv[0], &fv[0]);
+          }
+        catch (const std::exception& e)
+          {
+            return e.what();
+          }
+        return "";
+      };
+
+      reset();
+      vector<double> df1, df2, unused;
+      string ok=evaluate(2, df1), bad=evaluate(-2, unused);
+      CHECK(ok.empty());
+      CHECK(!bad.empty());
+
+      deferFiniteChecks=true;
+      reset();
+      CHECK(rhsTape.deferChecks);
+      CHECK_EQUAL(ok, evaluate(2, df2));
+      CHECK_ARRAY_EQUAL(df1, df2, df1.size());
+      CHECK_EQUAL(bad, evaluate(-2, unused));
+    }
+
+  // check that only the selected case of a switch is evaluated
+  TEST_FIXTURE(TestFixture,lazySwitch)
+    {
+      // x'=x for x>=1, sqrt(k) otherwise
+      auto k=model->addItem(VariablePtr(VariableType::parameter,"k"));
+      auto i=model->addItem(OperationPtr(OperationType::integrate));
+      auto s=model->addItem(OperationPtr(OperationType::sqrt));
+      auto sw=model->addItem(new SwitchIcon);
+      model->addWire(*k, *s, 1);
+      model->addWire(*i, *sw, 1);
+      model->addWire(*s, *sw, 2);
+      model->addWire(*i, *sw, 3);
+      model->addWire(*sw, *i, 1);
+      dynamic_cast<IntOp&>(*i).intVar->init("2");
+      variableValues[":k"].init="-1";
+      reset();
+      CHECK(find(rhsTape.opcode.begin(), rhsTape.opcode.end(), OperationType::numOps)!=
+            rhsTape.opcode.end());
+
+      vector<double> d(stockVars.size()), jac, scratch;
+      stockVars[0]=2;
+      evalEquations(&d[0], 0, &stockVars[0]);
+      CHECK_EQUAL(2, d[0]);
+      vector<double> flow(flowVars);
+      evalSparseJacobian(jac, 0, &stockVars[0], &flow[0], scratch);
+      CHECK_EQUAL(1, jac.size());
+      if (!jac.empty()) CHECK_EQUAL(1, jac[0]);
+
+      // selecting the invalid case is reported
+      stockVars[0]=0.5;
+      CHECK_THROW(evalEquations(&d[0], 0, &stockVars[0]), std::exception);
+
+      // unselected cases are still computed for display
+      variableValues[":k"].init="4";
+      reset();
+      CHECK_CLOSE(2, s->ports[0]->value(), 1e-10);
+
+      // switches are evaluated in parallel levels, and natively,
+      // selecting the same cases
+      auto check=[&]() {
+        for (double x: {2.0, 0.5})
+          {
+            stockVars[0]=x;
+            evalEquations(&d[0], 0, &stockVars[0]);
+            CHECK_CLOSE(x<1? 2: x, d[0], 1e-10);
+            vector<double> flow(flowVars);
+            evalSparseJacobian(jac, 0, &stockVars[0], &flow[0], scratch);
+            CHECK_EQUAL(1, jac.size());
+            if (!jac.empty()) CHECK_CLOSE(x<1? 0: 1, jac[0], 1e-10);
+          }
+      };
+      evalThreads=4;
+      reset();
+      rhsTape.schedule(rhsTape.threadPool(), 1);
+      jacTape.schedule(jacTape.threadPool(), 1);
+      CHECK(!rhsTape.levels().empty());
+      check();
+#ifndef _WIN32
+      evalThreads=1;
+      jit=true;
+      reset();
+      CHECK(jitEquations);
+      check();
+#endif
+    }
+
+  // check that integration restarts at a discontinuity, rather than
+  // stepping across it
+  TEST_FIXTURE(TestFixture,eventLocation)
+    {
+      // x'=t<0.55
+      auto time=model->addItem(OperationPtr(OperationType::time));
+      auto c=model->addItem(OperationPtr(OperationType::constant));
+      auto lt=model->addItem(OperationPtr(OperationType::lt));
+      auto i=model->addItem(OperationPtr(OperationType::integrate));
+      dynamic_cast<Constant&>(*c).value=0.55;
+      model->addWire(*time, *lt, 1);
+      model->addWire(*c, *lt, 2);
+      model->addWire(*lt, *i, 1);
+      locateEvents=true;
+      stepMax=0.1;
+      reset();
+      CHECK(ode);
+      // the right hand side is piecewise constant, so the error
+      // estimate alone would not limit the step size
+      for (double last=t; t<1; last=t)
+        {
+          ode->evolve(t, 1, &stockVars[0], 1);
+          CHECK(t-last<=stepMax*(1+1e-10));
+        }
+      CHECK_CLOSE(1, t, 1e-10);
+      CHECK_CLOSE(0.55, stockVars[0], 1e-5);
+    }
+
+  // check that separate models have separate simulation states
+  TEST_FIXTURE(TestFixture,independentModels)
+    {
+      Minsky other;
+      for (Minsky* m: {(Minsky*)this, &other})
+        {
+          auto c=m->model->addItem(OperationPtr(OperationType::constant));
+          auto i=m->model->addItem(OperationPtr(OperationType::integrate));
+          m->model->addWire(*c, *i, 1);
+          dynamic_cast<Constant&>(*c).value= m==this? 1: 2;
+          m->nSteps=10;
+          m->reset();
+        }
+      step();
+      other.step();
+      other.step();
+      CHECK_CLOSE(t, integrals[0].stock.value(), 1e-5);
+      {
+        LocalMinsky lm(other);
+        CHECK_CLOSE(2*other.t, other.integrals[0].stock.value(), 1e-5);
+      }
+      CHECK(t!=other.t);
+      CHECK_CLOSE(t, stockVars[integrals[0].stock.idx()], 1e-5);
+      CHECK_CLOSE(2*other.t, other.stockVars[other.integrals[0].stock.idx()], 1e-5);
+    }
+
+  TEST_FIXTURE(TestFixture,allocationFreeStep)
+    {
+      // x'=k x, with some auxiliary computation
+      auto k=model->addItem(VariablePtr(VariableType::parameter,"k"));
+      auto i=model->addItem(OperationPtr(OperationType::integrate));
+      auto m=model->addItem(OperationPtr(OperationType::multiply));
+      auto e=model->addItem(OperationPtr(OperationType::exp));
+      auto y=model->addItem(VariablePtr(VariableType::flow,"y"));
+      dynamic_cast<IntOp&>(*i).intVar->init("1");
+      model->addWire(*k, *m, 1);
+      model->addWire(*i, *m, 2);
+      model->addWire(*m, *i, 1);
+      model->addWire(*i, *e, 1);
+      model->addWire(*e, *y, 1);
+      variableValues[":k"].init="-0.5";
+
+      struct {int order; bool implicit; ODESolverType::Type solver;} configs[]=
+        {{1,false,ODESolverType::gsl}, {4,false,ODESolverType::gsl},
+         {4,true,ODESolverType::gsl}, {2,true,ODESolverType::rosenbrock},
+         {4,false,ODESolverType::explicitRK}};
+      for (auto& c: configs)
+        {
+          order=c.order;
+          implicit=c.implicit;
+          solver=c.solver;
+          reset();
+          step(); // workspace is sized on first use
+          size_t allocations=allocationCount();
+          step();
+          step();
+          CHECK_EQUAL(allocations, allocationCount());
+        }
+    }
+
+  TEST_FIXTURE(TestFixture,rosenbrockSolver)
+    {
+      // stiff system x'=-1000x, y'=-y
+      for (auto k: {"fast","slow"})
+        {
+          auto p=model->addItem(VariablePtr(VariableType::parameter,k));
+          auto i=model->addItem(OperationPtr(OperationType::integrate));
+          auto m=model->addItem(OperationPtr(OperationType::multiply));
+          dynamic_cast<IntOp&>(*i).description(string(k)+"Stock");
+          dynamic_cast<IntOp&>(*i).intVar->init("1");
+          model->addWire(*p, *m, 1);
+          model->addWire(*i, *m, 2);
+          model->addWire(*m, *i, 1);
+        }
+      variableValues[":fast"].init="-1000";
+      variableValues[":slow"].init="-1";
+      solver=ODESolverType::rosenbrock;
+      stepMax=1;
+      epsAbs=1e-8;
+      epsRel=1e-5;
+      reset();
+      auto& rb=dynamic_cast<Rosenbrock&>(*ode);
+      rb.evolve(t, 1, &stockVars[0]);
+      CHECK_EQUAL(1, t);
+      CHECK_CLOSE(std::exp(-1), variableValues[":slowStock"].value(), 1e-4);
+      CHECK(std::abs(variableValues[":fastStock"].value())<1e-6);
+      // an explicit method would need ~1000 steps for stability
+      CHECK(rb.numSteps<200);
+      CHECK(rb.numJacobians<rb.numSteps);
+      CHECK(rb.numFactorisations<rb.numSteps);
+
+      // step() advances a bounded number of steps
+      nSteps=3;
+      unsigned steps=rb.numSteps;
+      step();
+      CHECK_EQUAL(steps+3, rb.numSteps);
+    }
+
+  TEST_FIXTURE(TestFixture,explicitRKSolver)
+    {
+      // x'=-x/2
+      auto k=model->addItem(VariablePtr(VariableType::parameter,"k"));
+      auto i=model->addItem(OperationPtr(OperationType::integrate));
+      auto m=model->addItem(OperationPtr(OperationType::multiply));
+      dynamic_cast<IntOp&>(*i).description("x");
+      dynamic_cast<IntOp&>(*i).intVar->init("1");
+      model->addWire(*k, *m, 1);
+      model->addWire(*i, *m, 2);
+      model->addWire(*m, *i, 1);
+      variableValues[":k"].init="-0.5";
+      solver=ODESolverType::explicitRK;
+      stepMax=10;
+      epsAbs=1e-8;
+      epsRel=1e-8;
+      unsigned steps4=0;
+      for (int o: {2,4,8})
+        {
+          order=o;
+          reset();
+          auto& rk=dynamic_cast<ExplicitRK&>(*ode);
+          // dense output within a single step. The interpolant is
+          // cubic, so less accurate over the long steps of order 8
+          rk.evolve(t, 4, &stockVars[0], 1);
+          double x, tm=0.5*t;
+          CHECK(rk.interpolate(tm, &x));
+          CHECK_CLOSE(std::exp(-0.5*tm), x, o==8? 1e-3: 1e-5);
+
+          rk.evolve(t, 4, &stockVars[0]);
+          CHECK_EQUAL(4, t);
+          CHECK_CLOSE(std::exp(-2), stockVars[0], 1e-6);
+          // the derivative at the end of each step is reused
+          CHECK(rk.numRHS<=(o==2? 3: o==4? 6: 13)*(rk.numSteps+rk.numRejected)+2);
+          if (o==4)
+            {
+              CHECK(rk.numSteps<50);
+              steps4=rk.numSteps;
+            }
+          if (o==8)
+            CHECK(rk.numSteps<steps4);
+          CHECK(!rk.interpolate(t+1, &x));
+        }
+    }
+
+  TEST_FIXTURE(TestFixture,runUntil)
+    {
+      // x'=-x/2
+      auto k=model->addItem(VariablePtr(VariableType::parameter,"k"));
+      auto i=model->addItem(OperationPtr(OperationType::integrate));
+      auto m=model->addItem(OperationPtr(OperationType::multiply));
+      dynamic_cast<IntOp&>(*i).description("x");
+      dynamic_cast<IntOp&>(*i).intVar->init("1");
+      model->addWire(*k, *m, 1);
+      model->addWire(*i, *m, 2);
+      model->addWire(*m, *i, 1);
+      variableValues[":k"].init="-0.5";
+      epsAbs=1e-8;
+      epsRel=1e-8;
+
+      for (auto s: {ODESolverType::gsl, ODESolverType::explicitRK})
+        {
+          solver=s;
+          // dense output allows steps longer than the output interval
+          stepMax= s==ODESolverType::explicitRK? 10: 0.01;
+          reset();
+          vector<double> samples;
+          runUntil(1.05, 0.1, samples);
+          CHECK_EQUAL(1.05, t);
+          size_t w=sampleWidth();
+          CHECK_EQUAL(11*w, samples.size());
+          for (size_t j=0; j*w<samples.size(); ++j)
+            {
+              double ts=j<10? 0.1*(j+1): 1.05;
+              CHECK_CLOSE(ts, samples[j*w], 1e-12);
+              CHECK_CLOSE(std::exp(-0.5*ts), samples[j*w+1+variableValues[":x"].idx()], 1e-6);
+            }
+          // the final sample is the current state
+          CHECK_EQUAL(stockVars[0], samples[10*w+1]);
+
+          // continuing picks up at the next multiple of the interval
+          samples.clear();
+          runUntil(1.3, 0.1, samples);
+          CHECK_EQUAL(3*w, samples.size());
+          CHECK_CLOSE(1.1, samples[0], 1e-12);
+        }
+    }
+
+  // step, runUntil and sweeps take the same explicit Euler steps
+  TEST_FIXTURE(TestFixture,eulerConsistency)
+    {
+      // x'=-x/2
+      auto k=model->addItem(VariablePtr(VariableType::parameter,"k"));
+      auto i=model->addItem(OperationPtr(OperationType::integrate));
+      auto m=model->addItem(OperationPtr(OperationType::multiply));
+      dynamic_cast<IntOp&>(*i).description("x");
+      dynamic_cast<IntOp&>(*i).intVar->init("1");
+      model->addWire(*k, *m, 1);
+      model->addWire(*i, *m, 2);
+      model->addWire(*m, *i, 1);
+      variableValues[":k"].init="-0.5";
+      order=1;
+      implicit=false;
+      stepMax=0.1;
+      nSteps=10;
+      reset();
+      CHECK(!ode);
+      step();
+      CHECK_CLOSE(1, t, 1e-12);
+      double expected=pow(1-0.05, 10);
+      CHECK_CLOSE(expected, stockVars[0], 1e-12);
+
+      reset();
+      vector<double> samples;
+      runUntil(1, 0.5, samples);
+      CHECK_CLOSE(expected, stockVars[0], 1e-12);
+
+      parameterSweep.clear();
+      parameterSweep.addGrid(":k", -0.5, -0.5, 1);
+      parameterSweep.addOutput(":x");
+      parameterSweep.duration=1;
+      parameterSweep.numPoints=1;
+      parameterSweep.run(*this);
+      CHECK_CLOSE(expected, parameterSweep.results[0][0][1], 1e-12);
+    }
+
+  // check that a converted binary log matches the text log
+  TEST_FIXTURE(TestFixture,binaryLog)
+    {
+      auto c=model->addItem(OperationPtr(OperationType::constant));
+      auto i=model->addItem(OperationPtr(OperationType::integrate));
+      auto e=model->addItem(OperationPtr(OperationType::exp));
+      auto y=model->addItem(VariablePtr(VariableType::flow,"y"));
+      dynamic_cast<Constant&>(*c).value=0.5;
+      model->addWire(*c, *i, 1);
+      model->addWire(*i, *e, 1);
+      model->addWire(*e, *y, 1);
+      reset();
+      openLogFile("binaryLog.txt");
+      openBinaryLogFile("binaryLog.bin");
+      for (int j=0; j<100; ++j)
+        step();
+      closeLogFile();
+      convertLogFile("binaryLog.bin", "binaryLog.conv");
+
+      ifstream text("binaryLog.txt"), conv("binaryLog.conv");
+      string textLine, convLine;
+      size_t lines=0;
+      while (getline(text, textLine))
+        {
+          CHECK(getline(conv, convLine));
+          CHECK_EQUAL(textLine, convLine);
+          ++lines;
+        }
+      CHECK(!getline(conv, convLine));
+      CHECK_EQUAL(101, lines);
+
+#ifdef __linux__
+      // a failed write is reported when the log is closed
+      openBinaryLogFile("/dev/full");
+      for (int j=0; j<100; ++j)
+        step();
+      CHECK_THROW(closeLogFile(), ecolab::error);
+      CHECK(!binaryLogFile);
+#endif
+    }
+
+  TEST_FIXTURE(TestFixture,selectiveLogging)
+    {
+      auto time=model->addItem(OperationPtr(OperationType::time));
+      auto y=model->addItem(VariablePtr(VariableType::flow,"y"));
+      auto z=model->addItem(VariablePtr(VariableType::flow,"z"));
+      model->addWire(*time, *y, 1);
+      model->addWire(*time, *z, 1);
+      order=1; // explicit Euler, with fixed steps of stepMax
+      stepMax=0.01;
+      reset();
+
+      logSpec.addVariable(":y");
+      logSpec.decimation=2;
+      logSpec.addTrigger(":y",0.055);
+      openLogFile("selectiveLog.txt");
+      for (int i=0; i<20; ++i)
+        step();
+      closeLogFile();
+
+      ifstream log("selectiveLog.txt");
+      string line;
+      getline(log, line);
+      CHECK_EQUAL("#time :y", line);
+      vector<double> times;
+      double logT, logY;
+      while (log>>logT>>logY)
+        {
+          CHECK_CLOSE(logT, logY, 1e-10);
+          times.push_back(logT);
+        }
+      // every other step, from when y exceeds the trigger
+      CHECK_EQUAL(7, times.size());
+      if (!times.empty())
+        CHECK_CLOSE(0.07, times[0], 1e-10);
+
+      // a group without variables selects nothing, rather than everything
+      logSpec.variables.clear();
+      model->addGroup(new Group)->title="empty";
+      logSpec.addVariable("empty");
+      CHECK_THROW(openLogFile("selectiveLog.txt"), std::exception);
+
+      logSpec.addVariable("nonexistent");
+      CHECK_THROW(openLogFile("selectiveLog.txt"), std::exception);
+    }
+
+  TEST_FIXTURE(TestFixture,liveOutput)
+    {
+      auto time=model->addItem(OperationPtr(OperationType::time));
+      auto y=model->addItem(VariablePtr(VariableType::flow,"y"));
+      model->addWire(*time, *y, 1);
+      order=1;
+      stepMax=0.01;
+      reset();
+
+      logSpec.addVariable(":y");
+      openLiveOutput("liveOutput.ring", 8);
+      for (int i=0; i<20; ++i)
+        step();
+
+      SharedRingReader reader("liveOutput.ring");
+      CHECK_EQUAL(2, reader.columns().size());
+      if (reader.columns().size()==2)
+        {
+          CHECK_EQUAL("time", reader.columns()[0]);
+          CHECK_EQUAL(":y", reader.columns()[1]);
+        }
+      CHECK_EQUAL(20, reader.sequence());
+      double row[2];
+      // rows older than the capacity have been overwritten
+      CHECK(!reader.read(0, row));
+      for (uint64_t k=reader.sequence()-4; k<reader.sequence(); ++k)
+        if (reader.read(k, row))
+          {
+            CHECK_CLOSE((k+1)*stepMax, row[0], 1e-10);
+            CHECK_CLOSE(row[0], row[1], 1e-10);
+          }
+        else
+          CHECK(false);
+      closeLiveOutput();
+    }
+
+  // each log keeps the selection and decimation it was opened with
+  TEST_FIXTURE(TestFixture,independentLogs)
+    {
+      auto time=model->addItem(OperationPtr(OperationType::time));
+      auto y=model->addItem(VariablePtr(VariableType::flow,"y"));
+      auto z=model->addItem(VariablePtr(VariableType::flow,"z"));
+      model->addWire(*time, *y, 1);
+      model->addWire(*time, *z, 1);
+      order=1;
+      stepMax=0.01;
+      reset();
+
+      logSpec.addVariable(":y");
+      logSpec.addVariable(":z");
+      openLogFile("independentLog.txt");
+      logSpec.clear();
+      logSpec.addVariable(":y");
+      logSpec.decimation=2;
+      openLiveOutput("independentLog.ring", 32);
+      for (int i=0; i<20; ++i)
+        step();
+      closeLogFile();
+
+      ifstream log("independentLog.txt");
+      string line;
+      getline(log, line);
+      CHECK_EQUAL("#time :y :z", line);
+      size_t rows=0;
+      double logT, logY, logZ;
+      while (log>>logT>>logY>>logZ)
+        {
+          CHECK_CLOSE(logT, logZ, 1e-10);
+          ++rows;
+        }
+      CHECK_EQUAL(20, rows);
+
+      SharedRingReader reader("independentLog.ring");
+      CHECK_EQUAL(2, reader.columns().size());
+      CHECK_EQUAL(10, reader.sequence());
+      closeLiveOutput();
+    }
+
+  TEST_FIXTURE(TestFixture,parameterSweep)
+    {
+      auto rate=model->addItem(VariablePtr(VariableType::parameter,"rate"));
+      auto i=model->addItem(OperationPtr(OperationType::integrate));
+      dynamic_cast<IntOp&>(*i).description("output");
+      model->addWire(*rate, *i, 1);
+      auto e=model->addItem(OperationPtr(OperationType::exp));
+      auto y=model->addItem(VariablePtr(VariableType::flow,"y"));
+      model->addWire(*rate, *e, 1);
+      model->addWire(*e, *y, 1);
+
+      parameterSweep.addGrid(":rate",1,3,3);
+      parameterSweep.addOutput(":output");
+      parameterSweep.duration=2;
+      parameterSweep.numPoints=4;
+      parameterSweep.threads=2;
+      CHECK_EQUAL(3, parameterSweep.numRuns());
+      sweep();
+
+      CHECK_EQUAL(5, parameterSweep.times.size());
+      CHECK_CLOSE(2, parameterSweep.times.back(), 1e-10);
+      for (size_t r=0; r<3; ++r)
+        {
+          CHECK(parameterSweep.errors[r].empty());
+          CHECK_CLOSE(2*(r+1), parameterSweep.results[0][r].back(), 1e-4);
+        }
+      CHECK_CLOSE(4, parameterSweep.mean(0).back(), 1e-4);
+      CHECK_CLOSE(2, parameterSweep.quantile(0,0).back(), 1e-4);
+      CHECK_CLOSE(5, parameterSweep.quantile(0,0.75).back(), 1e-4);
+
+      // sampled sweep
+      parameterSweep.clear();
+      parameterSweep.addRange(":rate",1,3);
+      parameterSweep.addOutput(":output");
+      parameterSweep.samples=20;
+      sweep();
+      for (size_t r=0; r<20; ++r)
+        {
+          double x=parameterSweep.results[0][r].back();
+          CHECK(x>=2-1e-4 && x<=6+1e-4);
+          CHECK_CLOSE(2*parameterSweep.runParameters(r)[0], x, 1e-4);
+        }
+
+      // initial conditions of stocks can be swept
+      parameterSweep.clear();
+      parameterSweep.samples=0;
+      parameterSweep.addGrid(":output",1,2,2);
+      parameterSweep.addOutput(":output");
+      sweep();
+      for (size_t r=0; r<2; ++r)
+        {
+          CHECK(parameterSweep.errors[r].empty());
+          CHECK_CLOSE(r+1, parameterSweep.results[0][r].front(), 1e-10);
+        }
+
+      // flow variables computed by the equations cannot be swept
+      parameterSweep.clear();
+      parameterSweep.addGrid(":y",1,3,3);
+      CHECK_THROW(sweep(), ecolab::error);
+    }
+
+  TEST_FIXTURE(TestFixture,ensembleSweep)
+    {
+      // dx/dt = -k x, x(0)=1, with k swept
+      auto k=model->addItem(VariablePtr(VariableType::parameter,"k"));
+      auto x=model->addItem(VariablePtr(VariableType::flow,"x"));
+      auto mul=model->addItem(OperationPtr(OperationType::multiply));
+      auto neg=model->addItem(OperationPtr(OperationType::subtract));
+      auto zero=model->addItem(OperationPtr(OperationType::constant));
+      auto i=model->addItem(OperationPtr(OperationType::integrate));
+      dynamic_cast<IntOp&>(*i).description("output");
+      dynamic_cast<IntOp&>(*i).intVar->init("1");
+      model->addWire(*k, *mul, 1);
+      model->addWire(*i, *mul, 2);
+      model->addWire(*zero, *neg, 1);
+      model->addWire(*mul, *neg, 2);
+      model->addWire(*neg, *x, 1);
+      model->addWire(*x, *i, 1);
+
+      parameterSweep.addGrid(":k",0.5,2.5,5);
+      parameterSweep.addOutput(":output");
+      parameterSweep.numPoints=10;
+      epsAbs=epsRel=1e-10;
+      sweep();
+      auto scalar=parameterSweep.results;
+
+      for (unsigned lanes: {4,8})
+        {
+          parameterSweep.lanes=lanes;
+          sweep();
+          CHECK_EQUAL(5, parameterSweep.results[0].size());
+          for (size_t r=0; r<5; ++r)
+            {
+              CHECK(parameterSweep.errors[r].empty());
+              CHECK_CLOSE(std::exp(-(0.5+0.5*r)), parameterSweep.results[0][r].back(), 1e-6);
+              for (size_t p=0; p<scalar[0][r].size(); ++p)
+                CHECK_CLOSE(scalar[0][r][p], parameterSweep.results[0][r][p], 1e-6);
+            }
+        }
+
+      parameterSweep.lanes=3;
+      CHECK_THROW(sweep(), ecolab::error);
+    }
+
+#ifndef _WIN32
+  // check natively compiled equations against the interpreter
+  TEST_FIXTURE(TestFixture,jitEquations)
+    {
+      auto time=model->addItem(OperationPtr(OperationType::time));
+      auto s=model->addItem(OperationPtr(OperationType::sin));
+      auto m=model->addItem(OperationPtr(OperationType::multiply));
+      auto i=model->addItem(OperationPtr(OperationType::integrate));
+      auto y=model->addItem(VariablePtr(VariableType::flow,"y"));
+      model->addWire(*time, *s, 1);
+      model->addWire(*s, *m, 1);
+      model->addWire(*i, *m, 2);
+      model->addWire(*m, *y, 1);
+      model->addWire(*y, *i, 1);
+      reset();
+      CHECK(!jitEquations);
+      for (auto& x: stockVars) x=0.3;
+
+      size_t n=stockVars.size();
+      vector<double> r1(n), r2(n), j1(n*n), j2(n*n);
+      Matrix jac1(n,&j1[0]), jac2(n,&j2[0]);
+      evalEquations(&r1[0], 0.7, &stockVars[0]);
+      jacobian(jac1, 0.7, &stockVars[0]);
+
+      jit=true;
+      vector<double> sv(stockVars);
+      reset();
+      CHECK(jitEquations);
+      stockVars=sv;
+      evalEquations(&r2[0], 0.7, &stockVars[0]);
+      jacobian(jac2, 0.7, &stockVars[0]);
+      CHECK_ARRAY_CLOSE(r1, r2, n, 1e-10);
+      CHECK_ARRAY_CLOSE(j1, j2, n*n, 1e-10);
+
+      // data operations are not compiled, unless only needed for output
+      auto d=model->addItem(OperationPtr(OperationType::data));
+      auto dv=model->addItem(VariablePtr(VariableType::flow,"dv"));
+      model->addWire(*time, *d, 1);
+      model->addWire(*d, *dv, 1);
+      reset();
+      CHECK(jitEquations);
+      auto i2=model->addItem(OperationPtr(OperationType::integrate));
+      model->addWire(*dv, *i2, 1);
+      reset();
+      CHECK(!jitEquations);
+    }
+#endif
+
   /*
     check that cyclic networks throw an exception
 
@@ -689,6 +1843,94 @@ SUITE(Minsky)
     gsl_integration_workspace_free(ws);
   }
 
+  // interpolation must not depend on the order of lookups, nor on
+  // whether the data is uniformly spaced
+  TEST(dataOpInterpolation)
+  {
+    for (double jitter: {0.0, 0.01})
+      {
+        DataOp d;
+        map<double,double> data;
+        for (int i=0; i<1000; ++i)
+          data[i+(i%3)*jitter]=sin(0.01*i);
+        d.setData(data);
+        CHECK_EQUAL(data.size(), d.numPoints());
+        CHECK(d.getData()==data);
+        CHECK_EQUAL(data.begin()->second, d.interpolate(-1));
+        CHECK_EQUAL(data.rbegin()->second, d.interpolate(2000));
+        CHECK_EQUAL(0, d.deriv(-1));
+        auto p=data.find(500);
+        CHECK_EQUAL(p->second, d.interpolate(500));
+        // visit points forwards, backwards and at random
+        for (int j: {10, 11, 900, 899, 3, 700, 701, 0, 998})
+          {
+            double x=j+0.5, x0=prev(data.upper_bound(x))->first;
+            auto v0=data.find(x0), v1=next(v0);
+            CHECK_CLOSE(v0->second+(x-x0)*(v1->second-v0->second)/(v1->first-x0),
+                        d.interpolate(x), 1e-12);
+            CHECK_CLOSE((v1->second-v0->second)/(v1->first-x0), d.deriv(x), 1e-12);
+          }
+      }
+  }
+
+  TEST_FIXTURE(TestFixture,dataSetLoad)
+    {
+      {
+        ofstream f("dataSet.csv");
+        f<<"# prices\ntime,\"bid\",ask\r\n2,20,21\r\n1,10,11\r\n3,,31\r\nx,0,0\r\n";
+      }
+      remove("dataSet.csv.mkycache");
+      auto data=DataSet::load("dataSet.csv");
+      CHECK(data==DataSet::load("dataSet.csv"));
+      CHECK_EQUAL(3, data->names.size());
+      if (data->names.size()==3)
+        CHECK_EQUAL("bid", data->names[1]);
+      CHECK_EQUAL(3, data->x->size());
+      CHECK_EQUAL(2, data->y.size());
+      if (data->y.size()==2)
+        CHECK(isnan((*data->y[0])[2]));
+
+      DataOp bid, ask;
+      bid.readData("dataSet.csv");
+      ask.readDataColumn("dataSet.csv", 2);
+      CHECK_EQUAL("\\verb/dataSet.csv:ask/", ask.description);
+      CHECK_CLOSE(15, bid.interpolate(1.5), 1e-10);
+      CHECK_CLOSE(26, ask.interpolate(2.5), 1e-10);
+      CHECK_THROW(ask.readDataColumn("dataSet.csv", 3), ecolab::error);
+
+      // reload from the cache, once the shared copy has gone
+      cacheDataFiles=true;
+      data.reset();
+      bid.setData({});
+      ask.setData({});
+      DataSet::load("dataSet.csv", true);
+      CHECK(ifstream("dataSet.csv.mkycache").good());
+      ask.readDataColumn("dataSet.csv", 2);
+      CHECK_CLOSE(26, ask.interpolate(2.5), 1e-10);
+
+      // a corrupt cache is ignored, rather than allocating for it
+      ask.setData({});
+      data=DataSet::load("dataSet.csv", true);
+      {
+        ofstream f("dataSet.csv.mkycache", ios::binary);
+        uint64_t header[]={data->sourceSize, uint64_t(data->sourceTime), 3, uint64_t(1)<<60};
+        f.write("MKYDSET2", 8);
+        f.write(reinterpret_cast<const char*>(header), sizeof(header));
+      }
+      data.reset();
+      data=DataSet::load("dataSet.csv", true);
+      CHECK_EQUAL(3, data->x->size());
+
+      // nor is an empty data set cached
+      {
+        ofstream f("emptyDataSet.csv");
+        f<<"# nothing\n";
+      }
+      remove("emptyDataSet.csv.mkycache");
+      CHECK(DataSet::load("emptyDataSet.csv", true)->x->empty());
+      CHECK(!ifstream("emptyDataSet.csv.mkycache").good());
+    }
+
   TEST_FIXTURE(TestFixture,multiGodleyRules)
     {
       auto g1=new GodleyIcon; model->addItem(g1);